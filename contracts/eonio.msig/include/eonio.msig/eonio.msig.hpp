@@ -3,6 +3,16 @@
 #include <eosiolib/ignore.hpp>
 #include <eosiolib/transaction.hpp>
 
+#include <utility>
+#include <vector>
+
+#ifndef MSIG_LEGACY_APPROVALS
+// MSIG_LEGACY_APPROVALS macro determines whether approve, unapprove, cancel and exec fall back to
+// the "approvals" table of proposals made before "approvals2". Chains which have run migrateapps
+// for every proposer can build with the macro set to 0.
+#define MSIG_LEGACY_APPROVALS 1
+#endif
+
 namespace eosio {
 
    class [[eosio::contract("eonio.msig")]] multisig : public contract {
@@ -16,24 +26,34 @@ namespace eosio {
          void approve( name proposer, name proposal_name, permission_level level,
                        const eosio::binary_extension<eosio::checksum256>& proposal_hash );
          [[eosio::action]]
+         void approven( permission_level level, const std::vector<std::pair<name,name>>& proposals,
+                        const eosio::binary_extension<std::vector<eosio::checksum256>>& proposal_hashes );
+         [[eosio::action]]
          void unapprove( name proposer, name proposal_name, permission_level level );
          [[eosio::action]]
          void cancel( name proposer, name proposal_name, name canceler );
          [[eosio::action]]
-         void exec( name proposer, name proposal_name, name executer );
+         void exec( name proposer, name proposal_name, name executer,
+                    const eosio::binary_extension<bool>& exec_inline );
          [[eosio::action]]
          void invalidate( name account );
+         [[eosio::action]]
+         void migrateapps( name proposer, uint16_t max );
 
          using propose_action = eosio::action_wrapper<"propose"_n, &multisig::propose>;
          using approve_action = eosio::action_wrapper<"approve"_n, &multisig::approve>;
+         using approven_action = eosio::action_wrapper<"approven"_n, &multisig::approven>;
          using unapprove_action = eosio::action_wrapper<"unapprove"_n, &multisig::unapprove>;
          using cancel_action = eosio::action_wrapper<"cancel"_n, &multisig::cancel>;
          using exec_action = eosio::action_wrapper<"exec"_n, &multisig::exec>;
          using invalidate_action = eosio::action_wrapper<"invalidate"_n, &multisig::invalidate>;
+         using migrateapps_action = eosio::action_wrapper<"migrateapps"_n, &multisig::migrateapps>;
       private:
          struct [[eosio::table]] proposal {
             name                            proposal_name;
             std::vector<char>               packed_transaction;
+            /// sha256 of packed_transaction, absent in proposals made before it was stored
+            eosio::binary_extension<eosio::checksum256> trx_hash;
 
             uint64_t primary_key()const { return proposal_name.value; }
          };
@@ -67,6 +87,23 @@ namespace eosio {
          };
          typedef eosio::multi_index< "approvals2"_n, approvals_info > approvals;
 
+         /// proposals requesting more levels than this keep one row per requested level
+         static constexpr size_t max_approvals_per_row = 16;
+
+         struct [[eosio::table]] approval_level {
+            uint64_t                id;
+            name                    proposal_name;
+            permission_level        level;
+            time_point              time;
+            bool                    provided = false;
+
+            uint64_t  primary_key()const { return id; }
+            uint128_t by_level()const    { return (uint128_t(proposal_name.value) << 64) | level.actor.value; }
+         };
+         typedef eosio::multi_index< "apprlevels"_n, approval_level,
+                                     indexed_by<"bylevel"_n, const_mem_fun<approval_level, uint128_t, &approval_level::by_level>  >
+                                   > approval_levels;
+
          struct [[eosio::table]] invalidation {
             name         account;
             time_point   last_invalidation_time;
@@ -75,6 +112,20 @@ namespace eosio {
          };
 
          typedef eosio::multi_index< "invals"_n, invalidation > invalidations;
+
+         /// proposers whose "approvals" rows have all been converted by migrateapps
+         struct [[eosio::table]] approvals_migration {
+            name         proposer;
+            time_point   time;
+
+            uint64_t primary_key() const { return proposer.value; }
+         };
+
+         typedef eosio::multi_index< "appsmigrated"_n, approvals_migration > approvals_migrations;
+
+         void approve_proposal( name proposer, name proposal_name, const permission_level& level,
+                                const eosio::checksum256* proposal_hash );
+         bool has_approval_levels( name proposer, name proposal_name );
    };
 
 } /// namespace eosio
@@ -3,6 +3,9 @@
 #include <eosiolib/permission.hpp>
 #include <eosiolib/crypto.hpp>
 
+#include <algorithm>
+#include <tuple>
+
 namespace eosio {
 
 time_point current_time_point() {
@@ -10,6 +13,27 @@ time_point current_time_point() {
    return ct;
 }
 
+/**
+ *  Returns the per-level approval row of level in a proposal, or idx.end().
+ */
+template<typename Index>
+auto find_approval_level( const Index& idx, name proposal_name, const permission_level& level ) {
+   const uint128_t key = (uint128_t(proposal_name.value) << 64) | level.actor.value;
+   auto itr = idx.lower_bound( key );
+   while( itr != idx.end() && itr->by_level() == key && itr->level.permission != level.permission )
+      ++itr;
+   return ( itr != idx.end() && itr->by_level() == key ) ? itr : idx.end();
+}
+
+/**
+ *  Returns the first per-level approval row of a proposal, or idx.end() if it keeps its approvals in one row.
+ */
+template<typename Index>
+auto first_approval_level( const Index& idx, name proposal_name ) {
+   auto itr = idx.lower_bound( uint128_t(proposal_name.value) << 64 );
+   return ( itr != idx.end() && itr->proposal_name == proposal_name ) ? itr : idx.end();
+}
+
 void multisig::propose( ignore<name> proposer,
                         ignore<name> proposal_name,
                         ignore<std::vector<permission_level>> requested,
@@ -46,8 +70,29 @@ void multisig::propose( ignore<name> proposer,
    proptable.emplace( _proposer, [&]( auto& prop ) {
       prop.proposal_name       = _proposal_name;
       prop.packed_transaction  = pkd_trans;
+      prop.trx_hash            = sha256( trx_pos, size );
    });
 
+   if ( _requested.size() > max_approvals_per_row ) {
+      /// approvals look up the first row of a level, so every level must have only one
+      auto sorted = _requested;
+      std::sort( sorted.begin(), sorted.end(), []( const permission_level& a, const permission_level& b ) {
+         return std::tie( a.actor, a.permission ) < std::tie( b.actor, b.permission );
+      });
+      check( std::adjacent_find( sorted.begin(), sorted.end() ) == sorted.end(), "requested approvals must be unique" );
+
+      approval_levels lvltable( _self, _proposer.value );
+      for ( auto& level : _requested ) {
+         lvltable.emplace( _proposer, [&]( auto& a ) {
+            a.id            = lvltable.available_primary_key();
+            a.proposal_name = _proposal_name;
+            a.level         = level;
+            a.time          = time_point{ microseconds{0} };
+         });
+      }
+      return;
+   }
+
    approvals apptable(  _self, _proposer.value );
    apptable.emplace( _proposer, [&]( auto& a ) {
       a.proposal_name       = _proposal_name;
@@ -62,15 +107,43 @@ void multisig::approve( name proposer, name proposal_name, permission_level leve
                         const eosio::binary_extension<eosio::checksum256>& proposal_hash )
 {
    require_auth( level );
+   approve_proposal( proposer, proposal_name, level, proposal_hash ? &*proposal_hash : nullptr );
+}
 
+/**
+ *  Approves several proposals with one level. proposal_hashes, when given, holds the hash of each
+ *  proposal in the same order.
+ */
+void multisig::approven( permission_level level, const std::vector<std::pair<name,name>>& proposals,
+                         const eosio::binary_extension<std::vector<eosio::checksum256>>& proposal_hashes )
+{
+   require_auth( level );
+   check( !proposals.empty(), "no proposals to approve" );
+   check( !proposal_hashes || proposal_hashes->size() == proposals.size(), "one proposal hash is required per proposal" );
+
+   for ( size_t i = 0; i < proposals.size(); ++i ) {
+      approve_proposal( proposals[i].first, proposals[i].second, level,
+                        proposal_hashes ? &(*proposal_hashes)[i] : nullptr );
+   }
+}
+
+void multisig::approve_proposal( name proposer, name proposal_name, const permission_level& level,
+                                 const eosio::checksum256* proposal_hash )
+{
    if( proposal_hash ) {
       proposals proptable( _self, proposer.value );
       auto& prop = proptable.get( proposal_name.value, "proposal not found" );
-      assert_sha256( prop.packed_transaction.data(), prop.packed_transaction.size(), *proposal_hash );
+      if( prop.trx_hash ) {
+         check( *prop.trx_hash == *proposal_hash, "hash mismatch" );
+      } else {
+         assert_sha256( prop.packed_transaction.data(), prop.packed_transaction.size(), *proposal_hash );
+      }
    }
 
    approvals apptable(  _self, proposer.value );
    auto apps_it = apptable.find( proposal_name.value );
+   approval_levels lvltable( _self, proposer.value );
+   auto lvlidx = lvltable.get_index<"bylevel"_n>();
    if ( apps_it != apptable.end() ) {
       auto itr = std::find_if( apps_it->requested_approvals.begin(), apps_it->requested_approvals.end(), [&](const approval& a) { return a.level == level; } );
       check( itr != apps_it->requested_approvals.end(), "approval is not on the list of requested approvals" );
@@ -79,7 +152,18 @@ void multisig::approve( name proposer, name proposal_name, permission_level leve
             a.provided_approvals.push_back( approval{ level, current_time_point() } );
             a.requested_approvals.erase( itr );
          });
+   } else if ( has_approval_levels( proposer, proposal_name ) ) {
+      auto lvl_it = find_approval_level( lvlidx, proposal_name, level );
+      if ( lvl_it == lvlidx.end() ) {
+         check( first_approval_level( lvlidx, proposal_name ) != lvlidx.end(), "proposal not found" );
+      }
+      check( lvl_it != lvlidx.end() && !lvl_it->provided, "approval is not on the list of requested approvals" );
+      lvlidx.modify( lvl_it, proposer, [&]( auto& a ) {
+            a.provided = true;
+            a.time     = current_time_point();
+         });
    } else {
+#if MSIG_LEGACY_APPROVALS
       old_approvals old_apptable(  _self, proposer.value );
       auto& apps = old_apptable.get( proposal_name.value, "proposal not found" );
 
@@ -90,14 +174,33 @@ void multisig::approve( name proposer, name proposal_name, permission_level leve
             a.provided_approvals.push_back( level );
             a.requested_approvals.erase( itr );
          });
+#else
+      check( false, "proposal not found" );
+#endif
    }
 }
 
+/**
+ *  Returns whether the approvals of a proposal missing from "approvals2" are kept per level. Only
+ *  proposals storing trx_hash can have per-level rows, so older ones go to the legacy table without
+ *  the "bylevel" lookups.
+ */
+bool multisig::has_approval_levels( name proposer, name proposal_name ) {
+#if MSIG_LEGACY_APPROVALS
+   proposals proptable( _self, proposer.value );
+   return bool( proptable.get( proposal_name.value, "proposal not found" ).trx_hash );
+#else
+   return true;
+#endif
+}
+
 void multisig::unapprove( name proposer, name proposal_name, permission_level level ) {
    require_auth( level );
 
    approvals apptable(  _self, proposer.value );
    auto apps_it = apptable.find( proposal_name.value );
+   approval_levels lvltable( _self, proposer.value );
+   auto lvlidx = lvltable.get_index<"bylevel"_n>();
    if ( apps_it != apptable.end() ) {
       auto itr = std::find_if( apps_it->provided_approvals.begin(), apps_it->provided_approvals.end(), [&](const approval& a) { return a.level == level; } );
       check( itr != apps_it->provided_approvals.end(), "no approval previously granted" );
@@ -105,7 +208,18 @@ void multisig::unapprove( name proposer, name proposal_name, permission_level le
             a.requested_approvals.push_back( approval{ level, current_time_point() } );
             a.provided_approvals.erase( itr );
          });
+   } else if ( has_approval_levels( proposer, proposal_name ) ) {
+      auto lvl_it = find_approval_level( lvlidx, proposal_name, level );
+      if ( lvl_it == lvlidx.end() ) {
+         check( first_approval_level( lvlidx, proposal_name ) != lvlidx.end(), "proposal not found" );
+      }
+      check( lvl_it != lvlidx.end() && lvl_it->provided, "no approval previously granted" );
+      lvlidx.modify( lvl_it, proposer, [&]( auto& a ) {
+            a.provided = false;
+            a.time     = current_time_point();
+         });
    } else {
+#if MSIG_LEGACY_APPROVALS
       old_approvals old_apptable(  _self, proposer.value );
       auto& apps = old_apptable.get( proposal_name.value, "proposal not found" );
       auto itr = std::find( apps.provided_approvals.begin(), apps.provided_approvals.end(), level );
@@ -114,6 +228,9 @@ void multisig::unapprove( name proposer, name proposal_name, permission_level le
             a.requested_approvals.push_back( level );
             a.provided_approvals.erase( itr );
          });
+#else
+      check( false, "proposal not found" );
+#endif
    }
 }
 
@@ -126,22 +243,41 @@ void multisig::cancel( name proposer, name proposal_name, name canceler ) {
    if( canceler != proposer ) {
       check( unpack<transaction_header>( prop.packed_transaction ).expiration < eosio::time_point_sec(current_time_point()), "cannot cancel until expiration" );
    }
+   const bool has_levels = !MSIG_LEGACY_APPROVALS || prop.trx_hash;
    proptable.erase(prop);
 
    //remove from new table
+   approval_levels lvltable( _self, proposer.value );
+   auto lvlidx = lvltable.get_index<"bylevel"_n>();
    approvals apptable(  _self, proposer.value );
    auto apps_it = apptable.find( proposal_name.value );
    if ( apps_it != apptable.end() ) {
       apptable.erase(apps_it);
+   } else if ( has_levels ) {
+      auto lvl_it = first_approval_level( lvlidx, proposal_name );
+      check( lvl_it != lvlidx.end(), "proposal not found" );
+      while ( lvl_it != lvlidx.end() && lvl_it->proposal_name == proposal_name ) {
+         lvl_it = lvlidx.erase( lvl_it );
+      }
    } else {
+#if MSIG_LEGACY_APPROVALS
       old_approvals old_apptable(  _self, proposer.value );
       auto apps_it = old_apptable.find( proposal_name.value );
       check( apps_it != old_apptable.end(), "proposal not found" );
       old_apptable.erase(apps_it);
+#else
+      check( false, "proposal not found" );
+#endif
    }
 }
 
-void multisig::exec( name proposer, name proposal_name, name executer ) {
+/**
+ *  Executes an approved proposal. The transaction is sent as a deferred transaction, or with
+ *  exec_inline its actions are sent as inline actions of this one, which requires a transaction
+ *  without delay and without context-free actions.
+ */
+void multisig::exec( name proposer, name proposal_name, name executer,
+                     const eosio::binary_extension<bool>& exec_inline ) {
    require_auth( executer );
 
    proposals proptable( _self, proposer.value );
@@ -151,39 +287,80 @@ void multisig::exec( name proposer, name proposal_name, name executer ) {
    ds >> trx_header;
    check( trx_header.expiration >= eosio::time_point_sec(current_time_point()), "transaction expired" );
 
+   /// provided approvals are packed as a vector<permission_level> while they are read
+   std::vector<char> packed_levels;
+   uint32_t approvals_count = 0;
+   auto add_approval = [&]( const permission_level& level ) {
+      const auto size = packed_levels.size();
+      packed_levels.resize( size + pack_size( level ) );
+      datastream<char*> level_ds( packed_levels.data() + size, packed_levels.size() - size );
+      level_ds << level;
+      ++approvals_count;
+   };
+
+   approval_levels lvltable( _self, proposer.value );
+   auto lvlidx = lvltable.get_index<"bylevel"_n>();
    approvals apptable(  _self, proposer.value );
    auto apps_it = apptable.find( proposal_name.value );
-   std::vector<permission_level> approvals;
    invalidations inv_table( _self, _self.value );
    if ( apps_it != apptable.end() ) {
-      approvals.reserve( apps_it->provided_approvals.size() );
+      packed_levels.reserve( apps_it->provided_approvals.size() * sizeof(permission_level) );
       for ( auto& p : apps_it->provided_approvals ) {
          auto it = inv_table.find( p.level.actor.value );
          if ( it == inv_table.end() || it->last_invalidation_time < p.time ) {
-            approvals.push_back(p.level);
+            add_approval( p.level );
          }
       }
       apptable.erase(apps_it);
+   } else if ( !MSIG_LEGACY_APPROVALS || prop.trx_hash ) {
+      auto lvl_it = first_approval_level( lvlidx, proposal_name );
+      check( lvl_it != lvlidx.end(), "proposal not found" );
+      while ( lvl_it != lvlidx.end() && lvl_it->proposal_name == proposal_name ) {
+         if ( lvl_it->provided ) {
+            auto it = inv_table.find( lvl_it->level.actor.value );
+            if ( it == inv_table.end() || it->last_invalidation_time < lvl_it->time ) {
+               add_approval( lvl_it->level );
+            }
+         }
+         lvl_it = lvlidx.erase( lvl_it );
+      }
    } else {
+#if MSIG_LEGACY_APPROVALS
       old_approvals old_apptable(  _self, proposer.value );
       auto& apps = old_apptable.get( proposal_name.value, "proposal not found" );
       for ( auto& level : apps.provided_approvals ) {
          auto it = inv_table.find( level.actor.value );
          if ( it == inv_table.end() ) {
-            approvals.push_back( level );
+            add_approval( level );
          }
       }
       old_apptable.erase(apps);
+#else
+      check( false, "proposal not found" );
+#endif
    }
-   auto packed_provided_approvals = pack(approvals);
+   auto packed_provided_approvals = pack( unsigned_int{ approvals_count } );
+   packed_provided_approvals.insert( packed_provided_approvals.end(), packed_levels.begin(), packed_levels.end() );
    auto res = ::check_transaction_authorization( prop.packed_transaction.data(), prop.packed_transaction.size(),
                                                  (const char*)0, 0,
                                                  packed_provided_approvals.data(), packed_provided_approvals.size()
                                                  );
    check( res > 0, "transaction authorization failed" );
 
-   send_deferred( (uint128_t(proposer.value) << 64) | proposal_name.value, executer.value,
-                  prop.packed_transaction.data(), prop.packed_transaction.size() );
+   if ( exec_inline.value_or( false ) ) {
+      check( trx_header.delay_sec.value == 0, "transaction with a delay cannot be executed inline" );
+      std::vector<action> context_free_actions;
+      std::vector<action> actions;
+      ds >> context_free_actions;
+      check( context_free_actions.empty(), "transaction with context-free actions cannot be executed inline" );
+      ds >> actions;
+      for ( const auto& act : actions ) {
+         act.send();
+      }
+   } else {
+      send_deferred( (uint128_t(proposer.value) << 64) | proposal_name.value, executer.value,
+                     prop.packed_transaction.data(), prop.packed_transaction.size() );
+   }
 
    proptable.erase(prop);
 }
@@ -204,6 +381,48 @@ void multisig::invalidate( name account ) {
    }
 }
 
+/**
+ *  Converts up to max "approvals" rows of proposer to "approvals2" rows. Provided approvals get a
+ *  zero time, so any invalidation discards them in exec as it did for the old rows. Once no old
+ *  rows are left the proposer is recorded in "appsmigrated".
+ */
+void multisig::migrateapps( name proposer, uint16_t max ) {
+   const name payer = has_auth( proposer ) ? proposer : _self;
+   if( payer == _self )
+      require_auth( _self );
+   check( max > 0, "must migrate at least one proposal" );
+
+   old_approvals old_apptable(  _self, proposer.value );
+   approvals apptable(  _self, proposer.value );
+   bool migrated = false;
+   for ( auto old_it = old_apptable.begin(); old_it != old_apptable.end() && 0 < max; --max ) {
+      apptable.emplace( proposer, [&]( auto& a ) {
+         a.proposal_name = old_it->proposal_name;
+         a.requested_approvals.reserve( old_it->requested_approvals.size() );
+         for ( auto& level : old_it->requested_approvals ) {
+            a.requested_approvals.push_back( approval{ level, time_point{ microseconds{0} } } );
+         }
+         a.provided_approvals.reserve( old_it->provided_approvals.size() );
+         for ( auto& level : old_it->provided_approvals ) {
+            a.provided_approvals.push_back( approval{ level, time_point{ microseconds{0} } } );
+         }
+      });
+      old_it = old_apptable.erase( old_it );
+      migrated = true;
+   }
+
+   /// proposers without legacy rows are not recorded, so nobody can fill the table for free
+   if ( migrated && old_apptable.begin() == old_apptable.end() ) {
+      approvals_migrations migrations( _self, _self.value );
+      if ( migrations.find( proposer.value ) == migrations.end() ) {
+         migrations.emplace( payer, [&]( auto& m ) {
+            m.proposer = proposer;
+            m.time     = current_time_point();
+         });
+      }
+   }
+}
+
 } /// namespace eosio
 
-EOSIO_DISPATCH( eosio::multisig, (propose)(approve)(unapprove)(cancel)(exec)(invalidate) )
+EOSIO_DISPATCH( eosio::multisig, (propose)(approve)(approven)(unapprove)(cancel)(exec)(invalidate)(migrateapps) )
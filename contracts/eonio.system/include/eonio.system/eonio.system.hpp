@@ -24,6 +24,13 @@
 // be set to 0.
 #define CHANNEL_RAM_AND_NAMEBID_FEES_TO_REX 1
 
+#ifndef TRACK_PRODUCER_VOTEPAY_SHARE
+// TRACK_PRODUCER_VOTEPAY_SHARE macro determines whether votes update the producers votepay_share
+// and the global votepay_share totals. Chains which do not pay per vote rewards can build with the
+// macro set to 0, recompvpay must be run after building with it set back to 1.
+#define TRACK_PRODUCER_VOTEPAY_SHARE 1
+#endif
+
 namespace eosiosystem {
 
    using eosio::name;
@@ -81,6 +88,23 @@ namespace eosiosystem {
 
    typedef eosio::multi_index< "bidrefunds"_n, bid_refund > bid_refund_table;
 
+   /**
+    * Outbid refunds waiting to be claimed, in the order they were created, so that they can
+    * be paid out in batches by sweepbids
+    */
+   struct [[eosio::table, eosio::contract("eonio.system")]] bid_refund_request {
+      uint64_t     id;
+      name         bidder;
+      name         newname;
+
+      uint64_t  primary_key()const { return id; }
+      uint128_t by_refund()const   { return (uint128_t(newname.value) << 64) | bidder.value; }
+   };
+
+   typedef eosio::multi_index< "bidrefundq"_n, bid_refund_request,
+                               indexed_by<"byrefund"_n, const_mem_fun<bid_refund_request, uint128_t, &bid_refund_request::by_refund>  >
+                             > bid_refund_queue;
+
    struct [[eosio::table("global"), eosio::contract("eonio.system")]] eosio_global_state : eosio::blockchain_parameters {
       uint64_t free_ram()const { return max_ram_size - total_ram_bytes_reserved; }
 
@@ -141,6 +165,57 @@ namespace eosiosystem {
                                              (stake_to_gnode_fee)(new_proposal_fee)(min_producer_size) )
    };
 
+   /**
+    * Defines global state used to amortize settlements between system accounts
+    */
+   struct [[eosio::table("global4"), eosio::contract("eonio.system")]] eosio_global_state4 {
+      eosio_global_state4() { }
+      int64_t               pending_ramfee = 0;     /// ram fees held by eonio.ram until they are swept to eonio.ramfee
+      std::vector<uint32_t> schedule_unpaid_blocks; /// blocks produced but not yet folded into producer_info, by schedule position
+      block_timestamp       last_unpaid_blocks_fold;
+      bool                  producers3_migrated = false;    /// all producers have a producer_info3 row
+      name                  last_migrated_producer;
+      bool                  defer_vote_deltas = false;      /// producer vote changes are queued in votedeltas until the next schedule update
+      bool                  votepay_fixed_point = false;    /// votepay_share is kept in the fixed point fields below and in prodvpay
+      uint128_t             total_votepay_share = 0;        /// in vote microseconds, replaces total_producer_votepay_share
+      uint128_t             vpay_share_change_rate = 0;     /// in votes, replaces total_vpay_share_change_rate
+      block_timestamp       last_ledger_reconcile;          /// last time onblock settled the system ledger
+      uint64_t              next_exec_proposal = 0;         /// proposals with a lower id are settled for execprops
+      bool                  proposal_votes_migrated = false; /// no proposal has votes in the propvote layout
+      uint64_t              next_migrated_proposal = 0;     /// proposals with a lower id have no votes in the propvote layout
+
+      EOSLIB_SERIALIZE( eosio_global_state4, (pending_ramfee)(schedule_unpaid_blocks)(last_unpaid_blocks_fold)
+                                             (producers3_migrated)(last_migrated_producer)(defer_vote_deltas)
+                                             (votepay_fixed_point)(total_votepay_share)(vpay_share_change_rate)
+                                             (last_ledger_reconcile)(next_exec_proposal)
+                                             (proposal_votes_migrated)(next_migrated_proposal) )
+   };
+
+   /**
+    * Producers of the last proposed schedule sorted by name, their position is the index into
+    * eosio_global_state4::schedule_unpaid_blocks. Only written when the schedule changes.
+    */
+   struct [[eosio::table("schedpos"), eosio::contract("eonio.system")]] schedule_positions {
+      std::vector<name>     producers;
+
+      EOSLIB_SERIALIZE( schedule_positions, (producers) )
+   };
+
+   /**
+    * Balance of a system account on the internal ledger, i.e. the tokens moved to or from it by
+    * the system contract which are not yet settled on eonio.token. All balances sum to zero.
+    */
+   struct [[eosio::table, eosio::contract("eonio.system")]] ledger_entry {
+      name     account;
+      int64_t  balance = 0; /// positive when owed tokens, negative when holding tokens owed to others
+
+      uint64_t primary_key()const { return account.value; }
+
+      EOSLIB_SERIALIZE( ledger_entry, (account)(balance) )
+   };
+
+   typedef eosio::multi_index< "sysledger"_n, ledger_entry > system_ledger_table;
+
    struct [[eosio::table, eosio::contract("eonio.system")]] producer_info {
       name                  owner;
       double                total_votes = 0;
@@ -172,6 +247,65 @@ namespace eosiosystem {
       EOSLIB_SERIALIZE( producer_info2, (owner)(votepay_share)(last_votepay_share_update) )
    };
 
+   /**
+    * Fixed point votepay_share of a producer in vote microseconds, replaces producer_info2 once
+    * votepay_share is converted to fixed point.
+    */
+   struct [[eosio::table, eosio::contract("eonio.system")]] producer_votepay {
+      name            owner;
+      uint128_t       votepay_share = 0;
+      time_point      last_votepay_share_update;
+
+      uint64_t primary_key()const { return owner.value; }
+
+      // explicit serialization macro is not necessary, used here only to improve compilation time
+      EOSLIB_SERIALIZE( producer_votepay, (owner)(votepay_share)(last_votepay_share_update) )
+   };
+
+   /**
+    * Changes to the global votepay_share totals collected while updating the votes of several
+    * producers, the fixed point members are used once votepay_share is converted.
+    */
+   struct votepay_share_delta {
+      double          change_rate       = 0.0;
+      double          inactive_share    = 0.0;
+      int128_t        change_rate_fp    = 0;
+      int128_t        inactive_share_fp = 0;
+   };
+
+   /**
+    * Frequently updated producer fields, split from producer_info which keeps the registration data.
+    * Until all producers are migrated, producer_info is kept in sync and used to rank producers.
+    */
+   struct [[eosio::table, eosio::contract("eonio.system")]] producer_info3 {
+      name            owner;
+      double          total_votes = 0;
+      bool            is_active = true;
+      uint32_t        unpaid_blocks = 0;
+      time_point      last_claim_time;
+
+      uint64_t primary_key()const { return owner.value;                             }
+      double   by_votes()const    { return is_active ? -total_votes : total_votes;  }
+      bool     active()const      { return is_active;                               }
+
+      // explicit serialization macro is not necessary, used here only to improve compilation time
+      EOSLIB_SERIALIZE( producer_info3, (owner)(total_votes)(is_active)(unpaid_blocks)(last_claim_time) )
+   };
+
+   /**
+    * Vote weight change of a producer which is not yet applied to producer_info3::total_votes,
+    * used while eosio_global_state4::defer_vote_deltas is set.
+    */
+   struct [[eosio::table, eosio::contract("eonio.system")]] producer_vote_delta {
+      name            owner;
+      double          vote_delta = 0;
+
+      uint64_t primary_key()const { return owner.value; }
+
+      // explicit serialization macro is not necessary, used here only to improve compilation time
+      EOSLIB_SERIALIZE( producer_vote_delta, (owner)(vote_delta) )
+   };
+
    struct [[eosio::table, eosio::contract("eonio.system")]] goverance_node_info {
       name                  owner;
             
@@ -199,6 +333,30 @@ namespace eosiosystem {
       EOSLIB_SERIALIZE( proposal_vote_info, (owner)(vote)(vote_time) )
    };
 
+   /**
+    * Compact vote on a proposal, replaces proposal_vote_info. The vote time is kept in seconds
+    * since the start of the proposal and the vote itself in the highest bit.
+    */
+   struct [[eosio::table, eosio::contract("eonio.system")]] proposal_vote {
+      static constexpr uint32_t yea_flag = 0x80000000;
+
+      name            owner;
+      uint32_t        vote_info = 0;
+
+      uint64_t primary_key()const { return owner.value; }
+      bool     yea()const         { return vote_info & yea_flag; }
+
+      void set_vote( bool vote, time_point start_time, time_point vote_time ) {
+         const auto elapsed = (vote_time - start_time).to_seconds();
+         vote_info = uint32_t( elapsed > 0 ? elapsed : 0 ) & ~yea_flag;
+         if( vote )
+            vote_info |= yea_flag;
+      }
+
+      // explicit serialization macro is not necessary, used here only to improve compilation time
+      EOSLIB_SERIALIZE( proposal_vote, (owner)(vote_info) )
+   };
+
    struct [[eosio::table, eosio::contract("eonio.system")]] proposal_info {
       uint64_t        id;
 
@@ -260,14 +418,67 @@ namespace eosiosystem {
 
    typedef eosio::multi_index< "voters"_n, voter_info >  voters_table;
 
+   /**
+    * Compact voter layout: the stake and vote weight fields are kept apart from the list of voted
+    * producers in voter_producers, so that stake updates do not rewrite the list. voter_info rows
+    * are converted on the first write to the voter.
+    */
+   struct [[eosio::table, eosio::contract("eonio.system")]] voter_info2 {
+      name                owner;                    /// the voter
+      name                proxy;                    /// the proxy set by the voter, if any
+      int64_t             staked = 0;
+      double              last_vote_weight = 0;     /// the vote weight cast the last time the vote was updated
+      double              proxied_vote_weight = 0;  /// the total vote weight delegated to this voter as a proxy
+      bool                is_proxy = 0;             /// whether the voter is a proxy for others
+      uint8_t             num_producers = 0;        /// size of the producers list in voter_producers
+      uint32_t            flags1 = 0;
+
+      uint64_t primary_key()const { return owner.value; }
+
+      // explicit serialization macro is not necessary, used here only to improve compilation time
+      EOSLIB_SERIALIZE( voter_info2, (owner)(proxy)(staked)(last_vote_weight)(proxied_vote_weight)(is_proxy)(num_producers)(flags1) )
+   };
+
+   struct [[eosio::table, eosio::contract("eonio.system")]] voter_producers {
+      name                owner;
+      std::vector<name>   producers; /// the producers approved by this voter if no proxy set
+
+      uint64_t primary_key()const { return owner.value; }
+
+      // explicit serialization macro is not necessary, used here only to improve compilation time
+      EOSLIB_SERIALIZE( voter_producers, (owner)(producers) )
+   };
+
+   /**
+    * Proxy whose proxied_vote_weight changed since its weight was last pushed to its producers.
+    */
+   struct [[eosio::table, eosio::contract("eonio.system")]] dirty_proxy {
+      name                owner;
+
+      uint64_t primary_key()const { return owner.value; }
+
+      // explicit serialization macro is not necessary, used here only to improve compilation time
+      EOSLIB_SERIALIZE( dirty_proxy, (owner) )
+   };
+
+   typedef eosio::multi_index< "voters2"_n, voter_info2 >         voters_table2;
+   typedef eosio::multi_index< "voterprods"_n, voter_producers >  voter_producers_table;
+   typedef eosio::multi_index< "dirtyproxies"_n, dirty_proxy >    dirty_proxies_table;
+
 
    typedef eosio::multi_index< "producers"_n, producer_info,
                                indexed_by<"prototalvote"_n, const_mem_fun<producer_info, double, &producer_info::by_votes> > > producers_table;
    typedef eosio::multi_index< "producers2"_n, producer_info2 > producers_table2;
+   typedef eosio::multi_index< "prodvpay"_n, producer_votepay > producer_votepay_table;
+   typedef eosio::multi_index< "producers3"_n, producer_info3,
+                               indexed_by<"prototalvote"_n, const_mem_fun<producer_info3, double, &producer_info3::by_votes> > > producers_table3;
+
+   typedef eosio::multi_index< "votedeltas"_n, producer_vote_delta > vote_deltas_table;
 
    typedef eosio::multi_index< "gnode"_n, goverance_node_info > goverance_node_table;
 
    typedef eosio::multi_index< "propvote"_n, proposal_vote_info > proposal_vote_table;
+   typedef eosio::multi_index< "propvotes"_n, proposal_vote > proposal_votes_table;
 
    typedef eosio::multi_index< "proposals"_n, proposal_info,
                                indexed_by<"byendtime"_n, const_mem_fun<proposal_info, uint64_t, &proposal_info::by_end_time>  >
@@ -275,8 +486,11 @@ namespace eosiosystem {
    typedef eosio::singleton< "global"_n, eosio_global_state >   global_state_singleton;
    typedef eosio::singleton< "global2"_n, eosio_global_state2 > global_state2_singleton;
    typedef eosio::singleton< "global3"_n, eosio_global_state3 > global_state3_singleton;
+   typedef eosio::singleton< "global4"_n, eosio_global_state4 > global_state4_singleton;
+   typedef eosio::singleton< "schedpos"_n, schedule_positions > schedule_positions_singleton;
 
    static constexpr uint32_t     seconds_per_day = 24 * 3600;
+   static constexpr size_t       max_producer_votes = 30; /// maximum number of producers a voter can vote for
 
    struct [[eosio::table,eosio::contract("eonio.system")]] rex_pool {
       uint8_t    version = 0;
@@ -368,16 +582,24 @@ namespace eosiosystem {
 
       private:
          voters_table            _voters;
+         voters_table2           _voters2;
+         voter_producers_table   _voterprods;
+         dirty_proxies_table     _dirtyproxies;
          producers_table         _producers;
          producers_table2        _producers2;
+         producer_votepay_table  _prodvpay;
+         producers_table3        _producers3;
+         vote_deltas_table       _votedeltas;
          goverance_node_table    _gnode;
          proposals_table         _proposals;
          global_state_singleton  _global;
          global_state2_singleton _global2;
          global_state3_singleton _global3;
+         global_state4_singleton _global4;
          eosio_global_state      _gstate;
          eosio_global_state2     _gstate2;
          eosio_global_state3     _gstate3;
+         eosio_global_state4     _gstate4;
          rammarket               _rammarket;
          rex_pool_table          _rexpool;
          rex_fund_table          _rexfunds;
@@ -633,6 +855,30 @@ namespace eosiosystem {
          [[eosio::action]]
          void regproxy( const name proxy, bool isproxy );
 
+         /**
+          * Pushes the proxied vote weight which changed since the last update of proxy to the
+          * producers it votes for, delegators only update the proxied weight of their proxy.
+          */
+         [[eosio::action]]
+         void refreshproxy( const name proxy );
+
+         [[eosio::action]]
+         void migrateprods( uint16_t max );
+
+         /**
+          * Converts up to max proposal votes from the propvote layout to propvotes, proposal by
+          * proposal. Votes are only looked up in propvotes once all proposals are converted.
+          */
+         [[eosio::action]]
+         void migratepvote( uint16_t max );
+
+         /**
+          * Sets whether producer vote changes are queued and applied right before the producers
+          * are ranked for the next schedule, turning it off applies all queued changes.
+          */
+         [[eosio::action]]
+         void setvotedefer( bool defer );
+
          [[eosio::action]]
          void setparams( const eosio::blockchain_parameters& params );
 
@@ -640,6 +886,13 @@ namespace eosiosystem {
          [[eosio::action]]
          void execproposal( const name owner, uint64_t proposal_id );
 
+         /**
+          * Executes the satisfied proposals among the next max proposals which are not settled yet
+          * and proposes the resulting producers once.
+          */
+         [[eosio::action]]
+         void execprops( const name owner, uint16_t max );
+
          [[eosio::action]]
          void newproposal( const name owner, const name account, uint32_t block_height, int16_t type, int16_t status);
          
@@ -655,6 +908,12 @@ namespace eosiosystem {
          [[eosio::action]]
          void claimrewards( const name owner );
 
+         /**
+          * Claims the rewards of all owners at once, requires the authorization of every owner.
+          */
+         [[eosio::action]]
+         void claimrwdsn( const std::vector<name>& owners );
+
          [[eosio::action]]
          void setpriv( name account, uint8_t is_priv );
 
@@ -664,12 +923,32 @@ namespace eosiosystem {
          [[eosio::action]]
          void updtrevision( uint8_t revision );
 
+         /**
+          * Resets the votepay_share of all producers and rebuilds the global votepay_share totals
+          * from the current producer votes, used when votepay_share tracking is turned back on.
+          */
+         [[eosio::action]]
+         void recompvpay();
+
+         /**
+          * Converts the votepay_share of all producers and the global votepay_share totals to
+          * fixed point, after which votes no longer update them in floating point.
+          */
+         [[eosio::action]]
+         void convertvpay();
+
          [[eosio::action]]
          void bidname( name bidder, name newname, asset bid );
 
          [[eosio::action]]
          void bidrefund( name bidder, name newname );
 
+         [[eosio::action]]
+         void sweepbids( uint16_t max );
+
+         [[eosio::action]]
+         void reconcile();
+
          using init_action = eosio::action_wrapper<"init"_n, &system_contract::init>;
          using setacctram_action = eosio::action_wrapper<"setacctram"_n, &system_contract::setacctram>;
          using setacctnet_action = eosio::action_wrapper<"setacctnet"_n, &system_contract::setacctnet>;
@@ -706,16 +985,26 @@ namespace eosiosystem {
          using voteproposal_action = eosio::action_wrapper<"voteproposal"_n, &system_contract::voteproposal>;
          using voteproducer_action = eosio::action_wrapper<"voteproducer"_n, &system_contract::voteproducer>;
          using regproxy_action = eosio::action_wrapper<"regproxy"_n, &system_contract::regproxy>;
+         using refreshproxy_action = eosio::action_wrapper<"refreshproxy"_n, &system_contract::refreshproxy>;
+         using migrateprods_action = eosio::action_wrapper<"migrateprods"_n, &system_contract::migrateprods>;
+         using migratepvote_action = eosio::action_wrapper<"migratepvote"_n, &system_contract::migratepvote>;
+         using setvotedefer_action = eosio::action_wrapper<"setvotedefer"_n, &system_contract::setvotedefer>;
          using execproposal_action = eosio::action_wrapper<"execproposal"_n, &system_contract::execproposal>;
+         using execprops_action = eosio::action_wrapper<"execprops"_n, &system_contract::execprops>;
          using newproposal_action = eosio::action_wrapper<"newproposal"_n, &system_contract::newproposal>;
          using staketognode_action = eosio::action_wrapper<"staketognode"_n, &system_contract::staketognode>;
          using unstakegnode_action = eosio::action_wrapper<"unstakegnode"_n, &system_contract::unstakegnode>;
          using updategnode_action = eosio::action_wrapper<"updategnode"_n, &system_contract::updategnode>;
          using claimrewards_action = eosio::action_wrapper<"claimrewards"_n, &system_contract::claimrewards>;
+         using claimrwdsn_action = eosio::action_wrapper<"claimrwdsn"_n, &system_contract::claimrwdsn>;
          using rmvproducer_action = eosio::action_wrapper<"rmvproducer"_n, &system_contract::rmvproducer>;
          using updtrevision_action = eosio::action_wrapper<"updtrevision"_n, &system_contract::updtrevision>;
+         using recompvpay_action = eosio::action_wrapper<"recompvpay"_n, &system_contract::recompvpay>;
+         using convertvpay_action = eosio::action_wrapper<"convertvpay"_n, &system_contract::convertvpay>;
          using bidname_action = eosio::action_wrapper<"bidname"_n, &system_contract::bidname>;
          using bidrefund_action = eosio::action_wrapper<"bidrefund"_n, &system_contract::bidrefund>;
+         using sweepbids_action = eosio::action_wrapper<"sweepbids"_n, &system_contract::sweepbids>;
+         using reconcile_action = eosio::action_wrapper<"reconcile"_n, &system_contract::reconcile>;
          using setpriv_action = eosio::action_wrapper<"setpriv"_n, &system_contract::setpriv>;
          using setalimits_action = eosio::action_wrapper<"setalimits"_n, &system_contract::setalimits>;
          using setparams_action = eosio::action_wrapper<"setparams"_n, &system_contract::setparams>;
@@ -737,6 +1026,13 @@ namespace eosiosystem {
          static block_timestamp current_block_time();
          symbol core_symbol()const;
          void update_ram_supply();
+         static bool is_ledger_account( const name& account ) {
+            return account == stake_account || account == rex_account || account == ramfee_account || account == names_account;
+         }
+         void pay_bid_refund( name bidder, name newname );
+         void ledger_transfer( const name& from, const name& to, const asset& amount );
+         void settle_ledger( const name& account );
+         void reconcile_ledger();
 
          // defined in rex.cpp
          void runrex( uint16_t max );
@@ -777,24 +1073,54 @@ namespace eosiosystem {
          void changebw( name from, name receiver,
                         asset stake_net_quantity, asset stake_cpu_quantity, bool transfer );
          void update_voting_power( const name& voter, const asset& total_update );
+         void sweep_ramfee();
          void update_proposal_votes( const name voter_name, int64_t weight );
+         std::optional<bool> get_proposal_vote( uint64_t proposal_id, const name& voter_name )const;
+         bool has_legacy_proposal_votes( uint64_t proposal_id )const;
 
 
          // defined in prooducer_pay.cpp
-         uint16_t get_producers_size();
+         uint16_t get_producers_size( uint16_t max );
+         bool count_unpaid_block( const name& producer );
+         void fold_unpaid_blocks( const name& producer = name() );
+         int64_t claim_producer_rewards( const name& owner, time_point ct );
+         void set_schedule_positions( const std::vector<eosio::producer_key>& producers );
 
          // defined in voting.hpp
          void update_elected_producers( block_timestamp timestamp );
+         void propose_producers( std::vector< std::pair<eosio::producer_key,uint16_t> >& top_producers );
          void add_elected_producers( name new_producer, public_key key, std::string url, uint16_t loc, uint64_t proposal_id );
          void remove_elected_producers( name new_producer, uint64_t proposal_id );
          int64_t stake_to_proposal_votes( int64_t staked );
          void update_votes( const name voter, const name proxy, const std::vector<name>& producers, bool voting );
-         void propagate_weight_change( const voter_info& voter );
+         void propagate_weight_change( const voter_info2& voter );
+         void mark_proxy_dirty( const name& proxy );
+         void clear_proxy_dirty( const name& proxy );
+         void refresh_dirty_proxies( uint16_t max );
+         void add_producer_votes( const producers_table3::const_iterator& pitr, double delta, time_point ct,
+                                  votepay_share_delta& vpay_delta );
+         void queue_producer_votes( const name& producer, double delta );
+         bool apply_vote_deltas( uint16_t max );
+         voters_table2::const_iterator find_voter2( const name& owner );
+         std::optional<voter_info2> read_voter( const name& owner )const;
+         std::vector<name> get_voter_producers( const voter_info2& voter )const;
+         producers_table3::const_iterator find_producer3( const name& owner );
+         producers_table3::const_iterator copy_to_producers3( const producer_info& prod );
+         template <typename Lambda>
+         void modify_producer3( const producers_table3::const_iterator& itr, Lambda&& updater );
+         template <typename Lambda>
+         void for_each_producer_by_votes( Lambda&& f );
          double update_producer_votepay_share( const producers_table2::const_iterator& prod_itr,
                                                time_point ct,
                                                double shares_rate, bool reset_to_zero = false );
          double update_total_votepay_share( time_point ct,
                                             double additional_shares_delta = 0.0, double shares_rate_delta = 0.0 );
+         void update_total_votepay_share( time_point ct, const votepay_share_delta& vpay_delta );
+         uint128_t update_producer_votepay_share_fp( const producer_votepay_table::const_iterator& prod_itr,
+                                                     time_point ct,
+                                                     uint128_t shares_rate, bool reset_to_zero = false );
+         uint128_t update_total_votepay_share_fp( time_point ct,
+                                                  int128_t additional_shares_delta = 0, int128_t shares_rate_delta = 0 );
 
          template <auto system_contract::*...Ptrs>
          class registration {
@@ -120,21 +120,15 @@ namespace eosiosystem {
       auto quant_after_fee = quant;
       quant_after_fee.amount -= fee.amount;
       // quant_after_fee.amount should be > 0 if quant.amount > 1.
-      // If quant.amount == 1, then quant_after_fee.amount == 0 and the next inline transfer will fail causing the buyram action to fail.
+      // If quant.amount == 1, then quant_after_fee.amount == 0 and no bytes can be reserved causing the buyram action to fail.
 
+      // the fee is paid to eonio.ram together with the purchase and settled to eonio.ramfee by sweep_ramfee
       INLINE_ACTION_SENDER(eosio::token, transfer)(
          token_account, { {payer, active_permission}, {ram_account, active_permission} },
-         { payer, ram_account, quant_after_fee, std::string("buy ram") }
+         { payer, ram_account, quant, std::string("buy ram") }
       );
+      _gstate4.pending_ramfee += fee.amount;
 
-      if( fee.amount > 0 ) {
-         INLINE_ACTION_SENDER(eosio::token, transfer)(
-            token_account, { {payer, active_permission} },
-            { payer, ramfee_account, fee, std::string("ram fee") }
-         );
-         channel_to_rex( ramfee_account, fee );
-      }
-      
       int64_t bytes_out;
 
       const auto& market = _rammarket.get(ramcore_symbol.raw(), "ram market does not exist");
@@ -162,8 +156,8 @@ namespace eosiosystem {
             });
       }
 
-      auto voter_itr = _voters.find( res_itr->owner.value );
-      if( voter_itr == _voters.end() || !has_field( voter_itr->flags1, voter_info::flags1_fields::ram_managed ) ) {
+      auto voter_itr = read_voter( res_itr->owner );
+      if( !voter_itr || !has_field( voter_itr->flags1, voter_info::flags1_fields::ram_managed ) ) {
          int64_t ram_bytes, net, cpu;
          get_resource_limits( res_itr->owner.value, &ram_bytes, &net, &cpu );
          set_resource_limits( res_itr->owner.value, res_itr->ram_bytes + ram_gift_bytes, net, cpu );
@@ -206,27 +200,36 @@ namespace eosiosystem {
           res.ram_bytes -= bytes;
       });
 
-      auto voter_itr = _voters.find( res_itr->owner.value );
-      if( voter_itr == _voters.end() || !has_field( voter_itr->flags1, voter_info::flags1_fields::ram_managed ) ) {
+      auto voter_itr = read_voter( res_itr->owner );
+      if( !voter_itr || !has_field( voter_itr->flags1, voter_info::flags1_fields::ram_managed ) ) {
          int64_t ram_bytes, net, cpu;
          get_resource_limits( res_itr->owner.value, &ram_bytes, &net, &cpu );
          set_resource_limits( res_itr->owner.value, res_itr->ram_bytes + ram_gift_bytes, net, cpu );
       }
 
+      auto fee = ( tokens_out.amount + 199 ) / 200; /// .5% fee (round up)
+      // since tokens_out.amount was asserted to be at least 2 earlier, fee.amount < tokens_out.amount
+      // the fee is withheld by eonio.ram and settled to eonio.ramfee by sweep_ramfee
       INLINE_ACTION_SENDER(eosio::token, transfer)(
          token_account, { {ram_account, active_permission}, {account, active_permission} },
-         { ram_account, account, asset(tokens_out), std::string("sell ram") }
+         { ram_account, account, asset(tokens_out.amount - fee, core_symbol()), std::string("sell ram") }
       );
+      _gstate4.pending_ramfee += fee;
+   }
 
-      auto fee = ( tokens_out.amount + 199 ) / 200; /// .5% fee (round up)
-      // since tokens_out.amount was asserted to be at least 2 earlier, fee.amount < tokens_out.amount
-      if( fee > 0 ) {
-         INLINE_ACTION_SENDER(eosio::token, transfer)(
-            token_account, { {account, active_permission} },
-            { account, ramfee_account, asset(fee, core_symbol()), std::string("sell ram fee") }
-         );
-         channel_to_rex( ramfee_account, asset(fee, core_symbol() ));
-      }
+   /**
+    *  Settles the ram fees withheld by buyram and sellram since the last sweep with a single
+    *  transfer from eonio.ram to eonio.ramfee and channels them to the REX pool.
+    */
+   void system_contract::sweep_ramfee() {
+      const asset fee( _gstate4.pending_ramfee, core_symbol() );
+      _gstate4.pending_ramfee = 0;
+
+      INLINE_ACTION_SENDER(eosio::token, transfer)(
+         token_account, { {ram_account, active_permission} },
+         { ram_account, ramfee_account, fee, std::string("ram fee") }
+      );
+      channel_to_rex( ramfee_account, fee );
    }
 
    void validate_b1_vesting( int64_t stake ) {
@@ -300,8 +303,8 @@ namespace eosiosystem {
             bool net_managed = false;
             bool cpu_managed = false;
 
-            auto voter_itr = _voters.find( receiver.value );
-            if( voter_itr != _voters.end() ) {
+            auto voter_itr = read_voter( receiver );
+            if( voter_itr ) {
                ram_managed = has_field( voter_itr->flags1, voter_info::flags1_fields::ram_managed );
                net_managed = has_field( voter_itr->flags1, voter_info::flags1_fields::net_managed );
                cpu_managed = has_field( voter_itr->flags1, voter_info::flags1_fields::cpu_managed );
@@ -419,14 +422,14 @@ namespace eosiosystem {
 
    void system_contract::update_voting_power( const name& voter, const asset& total_update )
    {
-      auto voter_itr = _voters.find( voter.value );
-      if( voter_itr == _voters.end() ) {
-         voter_itr = _voters.emplace( voter, [&]( auto& v ) {
+      auto voter_itr = find_voter2( voter );
+      if( voter_itr == _voters2.end() ) {
+         voter_itr = _voters2.emplace( voter, [&]( auto& v ) {
             v.owner  = voter;
             v.staked = total_update.amount;
          });
       } else {
-         _voters.modify( voter_itr, same_payer, [&]( auto& v ) {
+         _voters2.modify( voter_itr, same_payer, [&]( auto& v ) {
             v.staked += total_update.amount;
          });
       }
@@ -437,8 +440,8 @@ namespace eosiosystem {
          validate_b1_vesting( voter_itr->staked );
       }
 
-      if( voter_itr->producers.size() || voter_itr->proxy ) {
-         update_votes( voter, voter_itr->proxy, voter_itr->producers, false );
+      if( voter_itr->num_producers || voter_itr->proxy ) {
+         update_votes( voter, voter_itr->proxy, get_voter_producers( *voter_itr ), false );
       }
    }
 
@@ -453,12 +456,11 @@ namespace eosiosystem {
       for(auto it = idx.cbegin(); it != idx.cend(); ++it) {
             if(it->end_time  <= ct) continue;
 
-            proposal_vote_table pvotes(_self, it->id);
-            auto vote_info = pvotes.find(voter_name.value);
+            auto vote = get_proposal_vote(it->id, voter_name);
 
-            if (vote_info != pvotes.end()) {
+            if (vote) {
                   idx.modify(it, voter_name, [&](auto& info){
-                  if(vote_info->vote == true) {
+                  if(*vote == true) {
                         info.total_yeas += weight;
                   } else {
                         info.total_nays += weight;
@@ -484,15 +486,15 @@ namespace eosiosystem {
 
       name change_account = transfer ? receiver : from;
 
-      auto voter = _voters.find( change_account.value );
-      if( voter != _voters.end() ) {
+      auto voter = read_voter( change_account );
+      if( voter ) {
             pvote_weight_old = stake_to_proposal_votes( voter->staked );
       }
 
       changebw( from, receiver, stake_net_quantity, stake_cpu_quantity, transfer);
 
-      voter = _voters.find( change_account.value );
-      if( voter != _voters.end() ) {
+      voter = read_voter( change_account );
+      if( voter ) {
             pvote_weight_new = stake_to_proposal_votes( voter->staked );
       }
 
@@ -517,15 +519,15 @@ namespace eosiosystem {
       int64_t pvote_weight_old = 0;
       int64_t pvote_weight_new = 0;
 
-      auto voter = _voters.find( from.value );
-      if( voter != _voters.end() ) {
+      auto voter = read_voter( from );
+      if( voter ) {
             pvote_weight_old = stake_to_proposal_votes( voter->staked );
       }
 
       changebw( from, receiver, -unstake_net_quantity, -unstake_cpu_quantity, false);
 
-      voter = _voters.find( from.value );
-      if( voter != _voters.end() ) {
+      voter = read_voter( from );
+      if( voter ) {
             pvote_weight_new = stake_to_proposal_votes( voter->staked );
       }
 
@@ -548,6 +550,7 @@ namespace eosiosystem {
       check( req->request_time + seconds(refund_delay_sec) <= current_time_point(),
              "refund is not available yet" );
 
+      settle_ledger( stake_account );
       INLINE_ACTION_SENDER(eosio::token, transfer)(
          token_account, { {stake_account, active_permission}, {req->owner, active_permission} },
          { stake_account, req->owner, req->net_amount + req->cpu_amount, std::string("unstake") }
@@ -13,13 +13,20 @@ namespace eosiosystem {
    system_contract::system_contract( name s, name code, datastream<const char*> ds )
    :native(s,code,ds),
     _voters(_self, _self.value),
+    _voters2(_self, _self.value),
+    _voterprods(_self, _self.value),
+    _dirtyproxies(_self, _self.value),
     _producers(_self, _self.value),
     _producers2(_self, _self.value),
+    _prodvpay(_self, _self.value),
+    _producers3(_self, _self.value),
+    _votedeltas(_self, _self.value),
     _gnode(_self, _self.value),
     _proposals(_self, _self.value),
     _global(_self, _self.value),
     _global2(_self, _self.value),
     _global3(_self, _self.value),
+    _global4(_self, _self.value),
     _rammarket(_self, _self.value),
     _rexpool(_self, _self.value),
     _rexfunds(_self, _self.value),
@@ -30,6 +37,7 @@ namespace eosiosystem {
       _gstate  = _global.exists() ? _global.get() : get_default_parameters();
       _gstate2 = _global2.exists() ? _global2.get() : eosio_global_state2{};
       _gstate3 = _global3.exists() ? _global3.get() : eosio_global_state3{};
+      _gstate4 = _global4.exists() ? _global4.get() : eosio_global_state4{};
    }
 
    eosio_global_state system_contract::get_default_parameters() {
@@ -62,6 +70,7 @@ namespace eosiosystem {
       _global.set( _gstate, _self );
       _global2.set( _gstate2, _self );
       _global3.set( _gstate3, _self );
+      _global4.set( _gstate4, _self );
    }
 
    void system_contract::setram( uint64_t max_ram_size ) {
@@ -135,8 +144,8 @@ namespace eosiosystem {
       auto ritr = userres.find( account.value );
       check( ritr == userres.end(), "only supports unlimited accounts" );
 
-      auto vitr = _voters.find( account.value );
-      if( vitr != _voters.end() ) {
+      auto vitr = read_voter( account );
+      if( vitr ) {
          bool ram_managed = has_field( vitr->flags1, voter_info::flags1_fields::ram_managed );
          bool net_managed = has_field( vitr->flags1, voter_info::flags1_fields::net_managed );
          bool cpu_managed = has_field( vitr->flags1, voter_info::flags1_fields::cpu_managed );
@@ -155,8 +164,8 @@ namespace eosiosystem {
       int64_t ram = 0;
 
       if( !ram_bytes ) {
-         auto vitr = _voters.find( account.value );
-         check( vitr != _voters.end() && has_field( vitr->flags1, voter_info::flags1_fields::ram_managed ),
+         auto vitr = find_voter2( account );
+         check( vitr != _voters2.end() && has_field( vitr->flags1, voter_info::flags1_fields::ram_managed ),
                 "RAM of account is already unmanaged" );
 
          user_resources_table userres( _self, account.value );
@@ -167,19 +176,19 @@ namespace eosiosystem {
             ram += ritr->ram_bytes;
          }
 
-         _voters.modify( vitr, same_payer, [&]( auto& v ) {
+         _voters2.modify( vitr, same_payer, [&]( auto& v ) {
             v.flags1 = set_field( v.flags1, voter_info::flags1_fields::ram_managed, false );
          });
       } else {
          check( *ram_bytes >= 0, "not allowed to set RAM limit to unlimited" );
 
-         auto vitr = _voters.find( account.value );
-         if ( vitr != _voters.end() ) {
-            _voters.modify( vitr, same_payer, [&]( auto& v ) {
+         auto vitr = find_voter2( account );
+         if ( vitr != _voters2.end() ) {
+            _voters2.modify( vitr, same_payer, [&]( auto& v ) {
                v.flags1 = set_field( v.flags1, voter_info::flags1_fields::ram_managed, true );
             });
          } else {
-            _voters.emplace( account, [&]( auto& v ) {
+            _voters2.emplace( account, [&]( auto& v ) {
                v.owner  = account;
                v.flags1 = set_field( v.flags1, voter_info::flags1_fields::ram_managed, true );
             });
@@ -200,8 +209,8 @@ namespace eosiosystem {
       int64_t net = 0;
 
       if( !net_weight ) {
-         auto vitr = _voters.find( account.value );
-         check( vitr != _voters.end() && has_field( vitr->flags1, voter_info::flags1_fields::net_managed ),
+         auto vitr = find_voter2( account );
+         check( vitr != _voters2.end() && has_field( vitr->flags1, voter_info::flags1_fields::net_managed ),
                 "Network bandwidth of account is already unmanaged" );
 
          user_resources_table userres( _self, account.value );
@@ -211,19 +220,19 @@ namespace eosiosystem {
             net = ritr->net_weight.amount;
          }
 
-         _voters.modify( vitr, same_payer, [&]( auto& v ) {
+         _voters2.modify( vitr, same_payer, [&]( auto& v ) {
             v.flags1 = set_field( v.flags1, voter_info::flags1_fields::net_managed, false );
          });
       } else {
          check( *net_weight >= -1, "invalid value for net_weight" );
 
-         auto vitr = _voters.find( account.value );
-         if ( vitr != _voters.end() ) {
-            _voters.modify( vitr, same_payer, [&]( auto& v ) {
+         auto vitr = find_voter2( account );
+         if ( vitr != _voters2.end() ) {
+            _voters2.modify( vitr, same_payer, [&]( auto& v ) {
                v.flags1 = set_field( v.flags1, voter_info::flags1_fields::net_managed, true );
             });
          } else {
-            _voters.emplace( account, [&]( auto& v ) {
+            _voters2.emplace( account, [&]( auto& v ) {
                v.owner  = account;
                v.flags1 = set_field( v.flags1, voter_info::flags1_fields::net_managed, true );
             });
@@ -244,8 +253,8 @@ namespace eosiosystem {
       int64_t cpu = 0;
 
       if( !cpu_weight ) {
-         auto vitr = _voters.find( account.value );
-         check( vitr != _voters.end() && has_field( vitr->flags1, voter_info::flags1_fields::cpu_managed ),
+         auto vitr = find_voter2( account );
+         check( vitr != _voters2.end() && has_field( vitr->flags1, voter_info::flags1_fields::cpu_managed ),
                 "CPU bandwidth of account is already unmanaged" );
 
          user_resources_table userres( _self, account.value );
@@ -255,19 +264,19 @@ namespace eosiosystem {
             cpu = ritr->cpu_weight.amount;
          }
 
-         _voters.modify( vitr, same_payer, [&]( auto& v ) {
+         _voters2.modify( vitr, same_payer, [&]( auto& v ) {
             v.flags1 = set_field( v.flags1, voter_info::flags1_fields::cpu_managed, false );
          });
       } else {
          check( *cpu_weight >= -1, "invalid value for cpu_weight" );
 
-         auto vitr = _voters.find( account.value );
-         if ( vitr != _voters.end() ) {
-            _voters.modify( vitr, same_payer, [&]( auto& v ) {
+         auto vitr = find_voter2( account );
+         if ( vitr != _voters2.end() ) {
+            _voters2.modify( vitr, same_payer, [&]( auto& v ) {
                v.flags1 = set_field( v.flags1, voter_info::flags1_fields::cpu_managed, true );
             });
          } else {
-            _voters.emplace( account, [&]( auto& v ) {
+            _voters2.emplace( account, [&]( auto& v ) {
                v.owner  = account;
                v.flags1 = set_field( v.flags1, voter_info::flags1_fields::cpu_managed, true );
             });
@@ -286,6 +295,9 @@ namespace eosiosystem {
       _producers.modify( prod, same_payer, [&](auto& p) {
             p.deactivate();
          });
+      _producers3.modify( find_producer3( producer ), same_payer, [&](auto& p) {
+            p.is_active = false;
+         });
    }
 
    void system_contract::updtrevision( uint8_t revision ) {
@@ -340,18 +352,15 @@ namespace eosiosystem {
                   r.bidder = current->high_bidder;
                   r.amount = asset( current->high_bid, core_symbol() );
                });
+            // the refund is claimed with bidrefund or paid out by sweepbids
+            bid_refund_queue queue(_self, _self.value);
+            queue.emplace( bidder, [&](auto& q) {
+                  q.id      = queue.available_primary_key();
+                  q.bidder  = current->high_bidder;
+                  q.newname = newname;
+               });
          }
 
-         transaction t;
-         t.actions.emplace_back( permission_level{_self, active_permission},
-                                 _self, "bidrefund"_n,
-                                 std::make_tuple( current->high_bidder, newname )
-         );
-         t.delay_sec = 0;
-         uint128_t deferred_id = (uint128_t(newname.value) << 64) | current->high_bidder.value;
-         cancel_deferred( deferred_id );
-         t.send( deferred_id, bidder );
-
          bids.modify( current, bidder, [&]( auto& b ) {
             b.high_bidder = bidder;
             b.high_bid = bid.amount;
@@ -361,6 +370,30 @@ namespace eosiosystem {
    }
 
    void system_contract::bidrefund( name bidder, name newname ) {
+      bid_refund_queue queue(_self, _self.value);
+      auto idx = queue.get_index<"byrefund"_n>();
+      auto qitr = idx.find( (uint128_t(newname.value) << 64) | bidder.value );
+      if( qitr != idx.end() ) {
+         idx.erase( qitr );
+      }
+      pay_bid_refund( bidder, newname );
+   }
+
+   /**
+    *  Pays out up to max of the oldest outstanding outbid refunds, anyone may call it.
+    */
+   void system_contract::sweepbids( uint16_t max ) {
+      check( 0 < max, "must sweep at least one refund" );
+      bid_refund_queue queue(_self, _self.value);
+      auto itr = queue.begin();
+      check( itr != queue.end(), "no refunds to sweep" );
+      for( ; itr != queue.end() && 0 < max; --max ) {
+         pay_bid_refund( itr->bidder, itr->newname );
+         itr = queue.erase( itr );
+      }
+   }
+
+   void system_contract::pay_bid_refund( name bidder, name newname ) {
       bid_refund_table refunds_table(_self, newname.value);
       auto it = refunds_table.find( bidder.value );
       check( it != refunds_table.end(), "refund not found" );
@@ -371,6 +404,92 @@ namespace eosiosystem {
       refunds_table.erase( it );
    }
 
+   /**
+    *  Moves tokens between system accounts on the internal ledger without an inline transfer.
+    *  The eonio.token balances are brought in sync by settle_ledger and reconcile_ledger.
+    */
+   void system_contract::ledger_transfer( const name& from, const name& to, const asset& amount ) {
+      check( is_ledger_account( from ) && is_ledger_account( to ), "account is not tracked by the system ledger" );
+
+      system_ledger_table ledger( _self, _self.value );
+      auto add_balance = [&]( const name& account, int64_t delta ) {
+         auto itr = ledger.find( account.value );
+         if( itr == ledger.end() ) {
+            ledger.emplace( _self, [&]( auto& e ) {
+               e.account = account;
+               e.balance = delta;
+            });
+         } else if( itr->balance + delta == 0 ) {
+            ledger.erase( itr );
+         } else {
+            ledger.modify( itr, same_payer, [&]( auto& e ) {
+               e.balance += delta;
+            });
+         }
+      };
+      add_balance( from, -amount.amount );
+      add_balance( to, amount.amount );
+   }
+
+   /**
+    *  Pays out the ledger balance owed to account with real transfers from the system accounts
+    *  holding its tokens, so that its eonio.token balance covers a transfer to a user.
+    */
+   void system_contract::settle_ledger( const name& account ) {
+      system_ledger_table ledger( _self, _self.value );
+      auto creditor = ledger.find( account.value );
+      if( creditor == ledger.end() || creditor->balance <= 0 )
+         return;
+
+      int64_t owed = creditor->balance;
+      for( auto itr = ledger.begin(); itr != ledger.end() && owed > 0; ) {
+         if( itr->balance >= 0 ) {
+            ++itr;
+            continue;
+         }
+         const int64_t amount = std::min( owed, -itr->balance );
+         INLINE_ACTION_SENDER(eosio::token, transfer)(
+            token_account, { {itr->account, active_permission} },
+            { itr->account, account, asset(amount, core_symbol()), std::string("system ledger settlement") }
+         );
+         owed -= amount;
+         if( amount == -itr->balance ) {
+            itr = ledger.erase( itr );
+         } else {
+            ledger.modify( itr, same_payer, [&]( auto& e ) {
+               e.balance += amount;
+            });
+            ++itr;
+         }
+      }
+      // ledger balances sum to zero so the holders always cover what is owed
+      check( owed == 0, "system ledger is out of balance" );
+      ledger.erase( creditor );
+   }
+
+   /**
+    *  Settles every ledger balance, after which the eonio.token balances of the system accounts
+    *  match the balances tracked by the system contract.
+    */
+   void system_contract::reconcile_ledger() {
+      system_ledger_table ledger( _self, _self.value );
+      std::vector<name> creditors;
+      for( const auto& e : ledger ) {
+         if( e.balance > 0 )
+            creditors.push_back( e.account );
+      }
+      for( const auto& account : creditors ) {
+         settle_ledger( account );
+      }
+   }
+
+   /**
+    *  Anyone may reconcile the system ledger, onblock also reconciles it once an hour.
+    */
+   void system_contract::reconcile() {
+      reconcile_ledger();
+   }
+
    /**
     *  Called after a new account is created. This code enforces resource-limits rules
     *  for new accounts as well as new account naming conventions.
@@ -466,14 +585,14 @@ EOSIO_DISPATCH( eosiosystem::system_contract,
      (newaccount)(updateauth)(deleteauth)(linkauth)(unlinkauth)(canceldelay)(onerror)(setabi)
      // eonio.system.cpp
      (init)(setram)(setramrate)(setparams)(setpriv)(setalimits)(setacctram)(setacctnet)(setacctcpu)
-     (rmvproducer)(updtrevision)(bidname)(bidrefund)
+     (rmvproducer)(updtrevision)(bidname)(bidrefund)(sweepbids)(reconcile)
      // rex.cpp
      (deposit)(withdraw)(buyrex)(unstaketorex)(sellrex)(cnclrexorder)(rentcpu)(rentnet)(fundcpuloan)(fundnetloan)
      (defcpuloan)(defnetloan)(updaterex)(consolidate)(mvtosavings)(mvfrsavings)(setrex)(rexexec)(closerex)
      // delegate_bandwidth.cpp
      (buyrambytes)(buyram)(sellram)(delegatebw)(undelegatebw)(refund)
      // voting.cpp
-     (regproducer)(unregprod)(voteproposal)(voteproducer)(regproxy)
+     (regproducer)(unregprod)(voteproposal)(voteproducer)(regproxy)(refreshproxy)(migrateprods)(migratepvote)(setvotedefer)(recompvpay)(convertvpay)
      // producer_pay.cpp
-     (onblock)(execproposal)(newproposal)(staketognode)(unstakegnode)(updategnode)(claimrewards)
+     (onblock)(execproposal)(execprops)(newproposal)(staketognode)(unstakegnode)(updategnode)(claimrewards)(claimrwdsn)
 )
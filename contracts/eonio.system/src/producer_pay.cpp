@@ -2,6 +2,8 @@
 
 #include <eonio.token/eonio.token.hpp>
 
+#include <algorithm>
+
 namespace eosiosystem {
 
    const int64_t  min_pervote_daily_pay = 100'0000;
@@ -15,6 +17,8 @@ namespace eosiosystem {
    const uint32_t blocks_per_hour       = 2 * 3600;
    const int64_t  useconds_per_day      = 24 * 3600 * int64_t(1000000);
    const int64_t  useconds_per_year     = seconds_per_year*1000000ll;
+   const uint16_t max_vote_deltas_per_block = 100;
+   const uint16_t max_proxy_refreshes_per_block = 5;
 
    void system_contract::onblock( ignore<block_header> ) {
       using namespace eosio;
@@ -30,9 +34,21 @@ namespace eosiosystem {
       // is eventually completely removed, at which point this line can be removed.
       _gstate2.last_block_num = timestamp;
 
+      /** ram fees collected during the previous block are settled to eonio.ramfee at once */
+      if( _gstate4.pending_ramfee > 0 )
+         sweep_ramfee();
+
+      /// balances moved on the system ledger are settled on eonio.token once an hour
+      if( timestamp.slot - _gstate4.last_ledger_reconcile.slot > blocks_per_hour ) {
+         reconcile_ledger();
+         _gstate4.last_ledger_reconcile = timestamp;
+      }
+
+      /** proxied vote weight changed by delegators is pushed to the producers of a few proxies per block */
+      refresh_dirty_proxies( max_proxy_refreshes_per_block );
 
       /** until activated stake crosses this threshold no new rewards are paid */
-      if( _gstate.total_activated_stake < min_activated_stake || get_producers_size() < _gstate3.min_producer_size )
+      if( _gstate.total_activated_stake < min_activated_stake || get_producers_size( _gstate3.min_producer_size ) < _gstate3.min_producer_size )
          return;
 
       if( _gstate.last_pervote_bucket_fill == time_point() )  /// start the presses
@@ -43,20 +59,33 @@ namespace eosiosystem {
        * At startup the initial producer may not be one that is registered / elected
        * and therefore there may be no producer object for them.
        */
-      auto prod = _producers.find( producer.value );
-      if ( prod != _producers.end() ) {
-         _gstate.total_unpaid_blocks++;
-         _producers.modify( prod, same_payer, [&](auto& p ) {
-               p.unpaid_blocks++;
-         });
+      if( !count_unpaid_block( producer ) ) {
+         auto prod = find_producer3( producer );
+         if ( prod != _producers3.end() ) {
+            _gstate.total_unpaid_blocks++;
+            modify_producer3( prod, [&](auto& p ) {
+                  p.unpaid_blocks++;
+            });
+         }
+      }
+
+      /// checkpoint the counted blocks into producer_info once an hour
+      if( timestamp.slot - _gstate4.last_unpaid_blocks_fold.slot > blocks_per_hour ) {
+         fold_unpaid_blocks();
+         _gstate4.last_unpaid_blocks_fold = timestamp;
       }
-      
+
+      /// only update block producers once every minute, block_timestamp is in half seconds
+      /// queued vote changes are applied in batches first, so that producers are ranked by their exact votes,
+      /// they are applied while proposals are open as well since the proposal actions rank producers too
+      const bool votes_applied = timestamp.slot - _gstate.last_producer_schedule_update.slot > 120 &&
+                                 apply_vote_deltas( max_vote_deltas_per_block );
+
       // 有proposal时，不再使用update_elected_producers
       // 临时措施
       if(_gstate.proposal_num != 0) return;
 
-      /// only update block producers once every minute, block_timestamp is in half seconds
-      if( timestamp.slot - _gstate.last_producer_schedule_update.slot > 120 ) {
+      if( votes_applied ) {
          update_elected_producers( timestamp );
 
          if( (timestamp.slot - _gstate.last_name_close.slot) > blocks_per_day ) {
@@ -81,16 +110,86 @@ namespace eosiosystem {
 
    using namespace eosio;
 
-   uint16_t system_contract::get_producers_size() {
+   /**
+    *  Counts the registered producers up to max, callers only compare the count with a small
+    *  number and must not walk every producer which ever registered. Once every producer is copied
+    *  the compact producers3 rows are counted.
+    */
+   uint16_t system_contract::get_producers_size( uint16_t max ) {
        uint16_t count = 0;
-       auto idx = _producers.get_index<"prototalvote"_n>();
-
-       for ( auto it = idx.cbegin(); it != idx.cend(); ++it ) {
-          ++ count;
+       if( _gstate4.producers3_migrated ) {
+          for ( auto it = _producers3.cbegin(); it != _producers3.cend() && count < max; ++it ) {
+             ++ count;
+          }
+       } else {
+          for ( auto it = _producers.cbegin(); it != _producers.cend() && count < max; ++it ) {
+             ++ count;
+          }
        }
        return count;
    }
 
+   /**
+    *  Counts a block produced by a producer of the last proposed schedule in the counter for its
+    *  schedule position, returns false if the producer is not part of that schedule.
+    */
+   bool system_contract::count_unpaid_block( const name& producer ) {
+      schedule_positions_singleton positions( _self, _self.value );
+      if( !positions.exists() )
+         return false;
+
+      const auto sched = positions.get();
+      auto itr = std::lower_bound( sched.producers.begin(), sched.producers.end(), producer );
+      if( itr == sched.producers.end() || *itr != producer )
+         return false;
+
+      _gstate4.schedule_unpaid_blocks.resize( sched.producers.size() );
+      _gstate4.schedule_unpaid_blocks[ itr - sched.producers.begin() ]++;
+      _gstate.total_unpaid_blocks++;
+      return true;
+   }
+
+   /**
+    *  Adds the counted blocks to unpaid_blocks of the producer rows, of all producers of the
+    *  schedule or only of producer if given.
+    */
+   void system_contract::fold_unpaid_blocks( const name& producer ) {
+      schedule_positions_singleton positions( _self, _self.value );
+      if( !positions.exists() )
+         return;
+
+      const auto sched = positions.get();
+      auto& counters = _gstate4.schedule_unpaid_blocks;
+      for( size_t i = 0; i < counters.size() && i < sched.producers.size(); ++i ) {
+         if( counters[i] == 0 || ( producer != name() && sched.producers[i] != producer ) )
+            continue;
+         auto prod = find_producer3( sched.producers[i] );
+         check( prod != _producers3.end(), "producer not found" );
+         modify_producer3( prod, [&](auto& p ) {
+               p.unpaid_blocks += counters[i];
+         });
+         counters[i] = 0;
+      }
+   }
+
+   /**
+    *  Starts counting blocks by position for a newly proposed schedule, the blocks counted for
+    *  the previous schedule are folded first.
+    */
+   void system_contract::set_schedule_positions( const std::vector<eosio::producer_key>& producers ) {
+      fold_unpaid_blocks();
+
+      schedule_positions sched;
+      sched.producers.reserve( producers.size() );
+      for( const auto& p : producers )
+         sched.producers.push_back( p.producer_name );
+      std::sort( sched.producers.begin(), sched.producers.end() );
+
+      schedule_positions_singleton positions( _self, _self.value );
+      positions.set( sched, _self );
+      _gstate4.schedule_unpaid_blocks.assign( sched.producers.size(), 0 );
+   }
+
    void system_contract::execproposal( const name owner, uint64_t proposal_id ) {
        require_auth( owner );
        const auto ct = current_time_point();
@@ -100,11 +199,10 @@ namespace eosiosystem {
 
        auto prop = _proposals.find( proposal_id );
        check(prop != _proposals.end(), "proposal_id not in _proposals");
-       if(get_producers_size() > 7) { // 多于7个时检查
+       if(get_producers_size( 8 ) > 7) { // 多于7个时检查
            check(ct > prop->end_time, "proposal not end");
        }
-            
-       
+
       // 检查proposal == 1是否满足条件，是这执行
         if( prop->type == 1 ) {
             if(prop->total_yeas - prop->total_nays > _gstate.total_proposal_stake / 10) {  // 提案是否满足条件 yeas-nays > staked/10 ?
@@ -114,6 +212,8 @@ namespace eosiosystem {
                 auto prod3 = _gnode.find( prop->account.value );
                 check(prod3 != _gnode.end(), "account not in _gnode");
 
+                /// the new schedule ranks producers by their votes, so the queued changes are applied first
+                check( apply_vote_deltas( std::numeric_limits<uint16_t>::max() ), "too many queued vote changes" );
                 add_elected_producers( prop->account, prod3->producer_key, prod3->url, prod3->location, prop->id);
                 _gnode.modify( prod3, owner, [&](auto& info) {
                     info.is_bp   = true;
@@ -128,6 +228,7 @@ namespace eosiosystem {
                 });
                 auto prod3 = _gnode.find( prop->account.value );
                 check(prod3 != _gnode.end(), "account not in _gnode");
+                check( apply_vote_deltas( std::numeric_limits<uint16_t>::max() ), "too many queued vote changes" );
                 remove_elected_producers( prop->account, prop->id);
                 _gnode.modify( prod3, owner, [&](auto& info) {
                     info.is_bp   = false;
@@ -185,6 +286,88 @@ namespace eosiosystem {
 
    }
 
+   /**
+    *  Executes the satisfied proposals among the next max proposals which are not settled yet, in
+    *  the order they end. The producer changes of all executed proposals are combined and the
+    *  producers are proposed once.
+    *
+    *  A proposal is settled once it is executed, is not a producer proposal or has ended when it is
+    *  reached, so an ended proposal which is not satisfied by then is not revisited. Add and remove
+    *  proposals all run for a day, so their ids follow their end times and the settled proposals
+    *  are skipped by starting at _gstate4.next_exec_proposal.
+    */
+   void system_contract::execprops( const name owner, uint16_t max ) {
+      require_auth( owner );
+      check( max > 0, "must execute at least one proposal" );
+      check( _gnode.find( owner.value ) != _gnode.end(), "only governance node can exec proposal" );
+
+      const auto ct = current_time_point();
+      const bool check_end = get_producers_size( 8 ) > 7; // 多于7个时检查
+
+      std::vector<name> removed;
+      bool changed = false;
+      bool settled = true; /// all proposals visited so far are settled
+      auto settle = [&]( uint64_t id, bool done ) {
+         settled = settled && done;
+         if( settled )
+            _gstate4.next_exec_proposal = id + 1;
+      };
+      for( auto prop = _proposals.lower_bound( _gstate4.next_exec_proposal ); prop != _proposals.end() && 0 < max; ++prop, --max ) {
+         if( prop->is_exec || (prop->type != 1 && prop->type != 2) ) {
+            settle( prop->id, true );
+            continue;
+         }
+         const bool ended = ct > prop->end_time;
+         if( check_end && !ended )
+            break;
+         // 提案是否满足条件 yeas-nays > staked/10 ?
+         if( prop->total_yeas - prop->total_nays <= _gstate.total_proposal_stake / 10 ) {
+            settle( prop->id, ended );
+            continue;
+         }
+
+         auto gnode = _gnode.find( prop->account.value );
+         check( gnode != _gnode.end(), "account not in _gnode" );
+         const bool is_producer = _producers.find( prop->account.value ) != _producers.end();
+         const bool add         = prop->type == 1;
+         if( add ) {
+            regproducer( prop->account, gnode->producer_key, gnode->url, gnode->location );
+            removed.erase( std::remove( removed.begin(), removed.end(), prop->account ), removed.end() );
+         } else if( is_producer && std::find( removed.begin(), removed.end(), prop->account ) == removed.end() ) {
+            removed.push_back( prop->account );
+         }
+         /// removing an account which is not a producer changes nothing, as in remove_elected_producers
+         const bool executed = add || is_producer;
+         changed = changed || executed;
+
+         _proposals.modify( prop, owner, [&]( auto& info ) {
+            info.is_satisfy = true;
+            info.is_exec    = executed;
+         });
+         _gnode.modify( gnode, owner, [&]( auto& info ) {
+            info.is_bp = add;
+         });
+         settle( prop->id, executed || ended );
+      }
+
+      if( !changed )
+         return;
+
+      check( apply_vote_deltas( std::numeric_limits<uint16_t>::max() ), "too many queued vote changes" );
+      /// inactive producers sort last, so the schedule holds every active producer which is not removed
+      std::vector< std::pair<eosio::producer_key,uint16_t> > top_producers;
+      for_each_producer_by_votes( [&]( const auto& p ) {
+         if ( !p.active() )
+            return false;
+         if ( std::find( removed.begin(), removed.end(), p.owner ) == removed.end() ) {
+            const auto& info = _producers.get( p.owner.value, "producer not found" );
+            top_producers.emplace_back( std::pair<eosio::producer_key,uint16_t>({{info.owner, info.producer_key}, info.location}) );
+         }
+         return true;
+      });
+      propose_producers( top_producers );
+   }
+
    // 抵押EON成为governance node, 可以发起提案
    void system_contract::staketognode( const name owner, const public_key& producer_key, const std::string& url, uint16_t location ) {
        require_auth( owner );
@@ -264,21 +447,66 @@ namespace eosiosystem {
    void system_contract::claimrewards( const name owner ) {
       require_auth( owner );
 
-      const auto& prod = _producers.get( owner.value );
-      check( prod.active(), "producer does not have an active key" );
+      check( _gstate.total_activated_stake >= min_activated_stake,
+                    "cannot claim rewards until the chain is activated (at least 15% of all tokens participate in voting)" );
+
+      const int64_t producer_per_block_pay = claim_producer_rewards( owner, current_time_point() );
+      if( producer_per_block_pay > 0 ) {
+         INLINE_ACTION_SENDER(eosio::token, transfer)(
+            token_account, { {blkpay_account, active_permission}, {owner, active_permission} },
+            { blkpay_account, owner, asset(producer_per_block_pay, core_symbol()), std::string("producer block pay") }
+         );
+      }
+   }
+
+   /**
+    *  Claims the rewards of several producers against one read of the global state, one transfer
+    *  is sent per producer which has block pay.
+    */
+   void system_contract::claimrwdsn( const std::vector<name>& owners ) {
+      check( !owners.empty(), "must claim rewards of at least one producer" );
+      {
+         std::vector<name> sorted( owners );
+         std::sort( sorted.begin(), sorted.end() );
+         check( std::adjacent_find( sorted.begin(), sorted.end() ) == sorted.end(), "producers must be unique" );
+      }
+      for( const auto& owner : owners ) {
+         require_auth( owner );
+      }
 
       check( _gstate.total_activated_stake >= min_activated_stake,
                     "cannot claim rewards until the chain is activated (at least 15% of all tokens participate in voting)" );
 
       const auto ct = current_time_point();
+      std::vector<int64_t> pays;
+      pays.reserve( owners.size() );
+      for( const auto& owner : owners ) {
+         pays.push_back( claim_producer_rewards( owner, ct ) );
+      }
 
-      check( ct - prod.last_claim_time > microseconds(useconds_per_day), "already claimed rewards within past day" );
+      for( size_t i = 0; i < owners.size(); ++i ) {
+         if( pays[i] > 0 ) {
+            INLINE_ACTION_SENDER(eosio::token, transfer)(
+               token_account, { {blkpay_account, active_permission}, {owners[i], active_permission} },
+               { blkpay_account, owners[i], asset(pays[i], core_symbol()), std::string("producer block pay") }
+            );
+         }
+      }
+   }
 
-      const asset token_supply   = eosio::token::get_supply(token_account, core_symbol().code() );
-      const auto usecs_since_last_fill = (ct - _gstate.last_pervote_bucket_fill).count();
+   /**
+    *  Settles the unpaid blocks of owner and returns its block pay, the caller checks the
+    *  authorization and the activation of the chain and sends the pay.
+    */
+   int64_t system_contract::claim_producer_rewards( const name& owner, time_point ct ) {
+      fold_unpaid_blocks( owner );
 
+      auto prod3 = find_producer3( owner );
+      check( prod3 != _producers3.end(), "unable to find key" );
+      const auto& prod = *prod3;
+      check( prod.active(), "producer does not have an active key" );
 
-      auto prod2 = _producers2.find( owner.value );
+      check( ct - prod.last_claim_time > microseconds(useconds_per_day), "already claimed rewards within past day" );
 
       /// New metric to be used in pervote pay calculation. Instead of vote weight ratio, we combine vote weight and
       /// time duration the vote weight has been held into one metric.
@@ -286,13 +514,26 @@ namespace eosiosystem {
 
       bool crossed_threshold       = (last_claim_plus_3days <= ct);
       bool updated_after_threshold = true;
-      if ( prod2 != _producers2.end() ) {
-         updated_after_threshold = (last_claim_plus_3days <= prod2->last_votepay_share_update);
+      if ( _gstate4.votepay_fixed_point ) {
+         auto vpay = _prodvpay.find( owner.value );
+         if ( vpay != _prodvpay.end() ) {
+            updated_after_threshold = (last_claim_plus_3days <= vpay->last_votepay_share_update);
+         } else {
+            _prodvpay.emplace( owner, [&]( producer_votepay& info  ) {
+               info.owner                     = owner;
+               info.last_votepay_share_update = ct;
+            });
+         }
       } else {
-         prod2 = _producers2.emplace( owner, [&]( producer_info2& info  ) {
-            info.owner                     = owner;
-            info.last_votepay_share_update = ct;
-         });
+         auto prod2 = _producers2.find( owner.value );
+         if ( prod2 != _producers2.end() ) {
+            updated_after_threshold = (last_claim_plus_3days <= prod2->last_votepay_share_update);
+         } else {
+            _producers2.emplace( owner, [&]( producer_info2& info  ) {
+               info.owner                     = owner;
+               info.last_votepay_share_update = ct;
+            });
+         }
       }
 
       // Note: updated_after_threshold implies cross_threshold (except if claiming rewards when the producers2 table row did not exist).
@@ -311,17 +552,12 @@ namespace eosiosystem {
 
       // update_total_votepay_share( ct, -new_votepay_share, (updated_after_threshold ? prod.total_votes : 0.0) );
 
-      _producers.modify( prod, same_payer, [&](auto& p) {
+      modify_producer3( prod3, [&](auto& p) {
          p.last_claim_time = ct;
          p.unpaid_blocks   = 0;
       });
 
-      if( producer_per_block_pay > 0 ) {
-         INLINE_ACTION_SENDER(eosio::token, transfer)(
-            token_account, { {blkpay_account, active_permission}, {owner, active_permission} },
-            { blkpay_account, owner, asset(producer_per_block_pay, core_symbol()), std::string("producer block pay") }
-         );
-      }
+      return producer_per_block_pay;
    }
 
 } //namespace eosiosystem
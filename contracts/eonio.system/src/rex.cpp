@@ -41,6 +41,7 @@ namespace eosiosystem {
       check( 0 < amount.amount, "must withdraw a positive amount" );
       update_rex_account( owner, asset( 0, core_symbol() ), asset( 0, core_symbol() ) );
       transfer_from_fund( owner, amount );
+      settle_ledger( rex_account );
       // inline transfer to owner's token balance
       {
          token::transfer_action transfer_act{ token_account, { rex_account, active_permission } };
@@ -105,11 +106,8 @@ namespace eosiosystem {
       update_resource_limits( name(0), receiver, -from_net.amount, -from_cpu.amount );
 
       const asset payment = from_net + from_cpu;
-      // inline transfer from stake_account to rex_account
-      {
-         token::transfer_action transfer_act{ token_account, { stake_account, active_permission } };
-         transfer_act.send( stake_account, rex_account, payment, "buy REX with staked tokens" );
-      }
+      // move tokens from stake_account to rex_account on the system ledger
+      ledger_transfer( stake_account, rex_account, payment );
       const asset rex_received = add_to_rex_pool( payment );
       add_to_rex_balance( owner, payment, rex_received );
       runrex(2);
@@ -542,8 +540,8 @@ namespace eosiosystem {
          bool net_managed = false;
          bool cpu_managed = false;
 
-         auto voter_itr = _voters.find( receiver.value );
-         if( voter_itr != _voters.end() ) {
+         auto voter_itr = read_voter( receiver );
+         if( voter_itr ) {
             net_managed = has_field( voter_itr->flags1, voter_info::flags1_fields::net_managed );
             cpu_managed = has_field( voter_itr->flags1, voter_info::flags1_fields::cpu_managed );
          }
@@ -573,8 +571,8 @@ namespace eosiosystem {
     */
    void system_contract::check_voting_requirement( const name& owner, const char* error_msg )const
    {
-      auto vitr = _voters.find( owner.value );
-      check( vitr != _voters.end() && ( vitr->proxy || 21 <= vitr->producers.size() ), error_msg );
+      auto vitr = read_voter( owner );
+      check( vitr && ( vitr->proxy || 21 <= vitr->num_producers ), error_msg );
    }
 
    /**
@@ -974,10 +972,8 @@ namespace eosiosystem {
             rp.total_unlent.amount   += amount.amount;
             rp.total_lendable.amount += amount.amount;
          });
-         // inline transfer to rex_account
-         token::transfer_action transfer_act{ token_account, { from, active_permission } };
-         transfer_act.send( from, rex_account, amount,
-                            std::string("transfer from ") + from.to_string() + " to eosio.rex" );
+         // move tokens to rex_account on the system ledger
+         ledger_transfer( from, rex_account, amount );
       }
 #endif
    }
@@ -1222,9 +1218,9 @@ namespace eosiosystem {
       }
 
       if ( delta_stake != 0 ) {
-         auto vitr = _voters.find( voter.value );
-         if ( vitr != _voters.end() ) {
-            _voters.modify( vitr, same_payer, [&]( auto& vinfo ) {
+         auto vitr = find_voter2( voter );
+         if ( vitr != _voters2.end() ) {
+            _voters2.modify( vitr, same_payer, [&]( auto& vinfo ) {
                vinfo.staked += delta_stake;
             });
          }
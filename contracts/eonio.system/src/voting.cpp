@@ -15,6 +15,7 @@
 #include <eonio.token/eonio.token.hpp>
 
 #include <algorithm>
+#include <array>
 #include <cmath>
 
 namespace eosiosystem {
@@ -48,17 +49,43 @@ namespace eosiosystem {
             if ( info.last_claim_time == time_point() )
                info.last_claim_time = ct;
          });
+         auto prod3 = find_producer3( producer );
+         _producers3.modify( prod3, same_payer, [&]( producer_info3& info ){
+            info.is_active = true;
+            if ( info.last_claim_time == time_point() )
+               info.last_claim_time = ct;
+         });
 
-         auto prod2 = _producers2.find( producer.value );
-         if ( prod2 == _producers2.end() ) {
-            _producers2.emplace( producer, [&]( producer_info2& info ){
-               info.owner                     = producer;
-               info.last_votepay_share_update = ct;
-            });
-            update_total_votepay_share( ct, 0.0, prod->total_votes );
-            // When introducing the producer2 table row for the first time, the producer's votes must also be accounted for in the global total_producer_votepay_share at the same time.
+         if ( _gstate4.votepay_fixed_point ) {
+            if ( _prodvpay.find( producer.value ) == _prodvpay.end() ) {
+               _prodvpay.emplace( producer, [&]( producer_votepay& info ){
+                  info.owner                     = producer;
+                  info.last_votepay_share_update = ct;
+               });
+#if TRACK_PRODUCER_VOTEPAY_SHARE
+               update_total_votepay_share_fp( ct, 0, static_cast<int128_t>( prod3->total_votes ) );
+#endif
+            }
+         } else {
+            auto prod2 = _producers2.find( producer.value );
+            if ( prod2 == _producers2.end() ) {
+               _producers2.emplace( producer, [&]( producer_info2& info ){
+                  info.owner                     = producer;
+                  info.last_votepay_share_update = ct;
+               });
+#if TRACK_PRODUCER_VOTEPAY_SHARE
+               update_total_votepay_share( ct, 0.0, prod3->total_votes );
+#endif
+               // When introducing the producer2 table row for the first time, the producer's votes must also be accounted for in the global total_producer_votepay_share at the same time.
+            }
          }
       } else {
+         // nothing to migrate or convert when the first producer registers
+         if ( _producers.begin() == _producers.end() ) {
+            _gstate4.producers3_migrated = true;
+            _gstate4.votepay_fixed_point = true;
+         }
+
          _producers.emplace( producer, [&]( producer_info& info ){
             info.owner           = producer;
             info.total_votes     = 0;
@@ -68,10 +95,22 @@ namespace eosiosystem {
             info.location        = location;
             info.last_claim_time = ct;
          });
-         _producers2.emplace( producer, [&]( producer_info2& info ){
-            info.owner                     = producer;
-            info.last_votepay_share_update = ct;
+         _producers3.emplace( producer, [&]( producer_info3& info ){
+            info.owner           = producer;
+            info.is_active       = true;
+            info.last_claim_time = ct;
          });
+         if ( _gstate4.votepay_fixed_point ) {
+            _prodvpay.emplace( producer, [&]( producer_votepay& info ){
+               info.owner                     = producer;
+               info.last_votepay_share_update = ct;
+            });
+         } else {
+            _producers2.emplace( producer, [&]( producer_info2& info ){
+               info.owner                     = producer;
+               info.last_votepay_share_update = ct;
+            });
+         }
       }
 
    }
@@ -83,24 +122,83 @@ namespace eosiosystem {
       _producers.modify( prod, same_payer, [&]( producer_info& info ){
          info.deactivate();
       });
+      _producers3.modify( find_producer3( producer ), same_payer, [&]( producer_info3& info ){
+         info.is_active = false;
+      });
    }
 
-   void system_contract::update_elected_producers( block_timestamp block_time ) {
-      _gstate.last_producer_schedule_update = block_time;
+   /**
+    *  Copies up to max producers which do not have a producer_info3 row yet, once all producers
+    *  are copied producer_info is no longer kept in sync and producers are ranked by producer_info3.
+    */
+   void system_contract::migrateprods( uint16_t max ) {
+      check( !_gstate4.producers3_migrated, "producers are already migrated" );
+      check( 0 < max, "must migrate at least one producer" );
+
+      auto itr = _producers.upper_bound( _gstate4.last_migrated_producer.value );
+      for( ; itr != _producers.end() && 0 < max; ++itr, --max ) {
+         if( _producers3.find( itr->owner.value ) == _producers3.end() )
+            copy_to_producers3( *itr );
+         _gstate4.last_migrated_producer = itr->owner;
+      }
+      if( itr == _producers.end() )
+         _gstate4.producers3_migrated = true;
+   }
 
-      auto idx = _producers.get_index<"prototalvote"_n>();
+   producers_table3::const_iterator system_contract::copy_to_producers3( const producer_info& prod ) {
+      return _producers3.emplace( _self, [&]( producer_info3& info ){
+         info.owner           = prod.owner;
+         info.total_votes     = prod.total_votes;
+         info.is_active       = prod.is_active;
+         info.unpaid_blocks   = prod.unpaid_blocks;
+         info.last_claim_time = prod.last_claim_time;
+      });
+   }
 
-      std::vector< std::pair<eosio::producer_key,uint16_t> > top_producers;
-      top_producers.reserve(21);
+   /**
+    *  Finds the producer_info3 row of owner, copying it from producer_info while the migration
+    *  is in progress.
+    */
+   producers_table3::const_iterator system_contract::find_producer3( const name& owner ) {
+      auto itr = _producers3.find( owner.value );
+      if( itr == _producers3.end() && !_gstate4.producers3_migrated ) {
+         auto prod = _producers.find( owner.value );
+         if( prod != _producers.end() )
+            itr = copy_to_producers3( *prod );
+      }
+      return itr;
+   }
 
-      for ( auto it = idx.cbegin(); it != idx.cend() && top_producers.size() < 21 && 0 < it->total_votes && it->active(); ++it ) {
-         top_producers.emplace_back( std::pair<eosio::producer_key,uint16_t>({{it->owner, it->producer_key}, it->location}) );
+   /**
+    *  Applies updater to the producer_info3 row, and to the producer_info row as well until
+    *  the migration is complete. updater must only change the fields shared by both rows.
+    */
+   template <typename Lambda>
+   void system_contract::modify_producer3( const producers_table3::const_iterator& itr, Lambda&& updater ) {
+      if( !_gstate4.producers3_migrated ) {
+         _producers.modify( _producers.get( itr->owner.value, "producer not found" ), same_payer, updater );
       }
-      // bp数量不能减少？
-      // if ( top_producers.size() < _gstate.last_producer_schedule_size ) {
-      //    return;
-      // }
+      _producers3.modify( itr, same_payer, updater );
+   }
+
+   /**
+    *  Calls f for producers in order of votes, active producers first, until it returns false.
+    */
+   template <typename Lambda>
+   void system_contract::for_each_producer_by_votes( Lambda&& f ) {
+      if( _gstate4.producers3_migrated ) {
+         auto idx = _producers3.get_index<"prototalvote"_n>();
+         for( auto it = idx.cbegin(); it != idx.cend() && f( *it ); ++it );
+      } else {
+         auto idx = _producers.get_index<"prototalvote"_n>();
+         for( auto it = idx.cbegin(); it != idx.cend() && f( *it ); ++it );
+      }
+   }
 
+   /**
+    *  Proposes top_producers as the new producer schedule.
+    */
+   void system_contract::propose_producers( std::vector< std::pair<eosio::producer_key,uint16_t> >& top_producers ) {
       /// sort by producer name
       std::sort( top_producers.begin(), top_producers.end() );
 
@@ -114,9 +212,31 @@ namespace eosiosystem {
 
       if( set_proposed_producers( packed_schedule.data(),  packed_schedule.size() ) >= 0 ) {
          _gstate.last_producer_schedule_size = static_cast<decltype(_gstate.last_producer_schedule_size)>( top_producers.size() );
+         set_schedule_positions( producers );
       }
    }
 
+   void system_contract::update_elected_producers( block_timestamp block_time ) {
+      _gstate.last_producer_schedule_update = block_time;
+
+      std::vector< std::pair<eosio::producer_key,uint16_t> > top_producers;
+      top_producers.reserve(21);
+
+      for_each_producer_by_votes( [&]( const auto& p ) {
+         if ( top_producers.size() >= 21 || !(0 < p.total_votes) || !p.active() )
+            return false;
+         const auto& info = _producers.get( p.owner.value, "producer not found" );
+         top_producers.emplace_back( std::pair<eosio::producer_key,uint16_t>({{info.owner, info.producer_key}, info.location}) );
+         return true;
+      });
+      // bp数量不能减少？
+      // if ( top_producers.size() < _gstate.last_producer_schedule_size ) {
+      //    return;
+      // }
+
+      propose_producers( top_producers );
+   }
+
    // 提案type==1，将account 加到producer
    void system_contract::add_elected_producers( name new_producer, public_key key, std::string url, uint16_t loc, uint64_t proposal_id ) {
       
@@ -124,30 +244,18 @@ namespace eosiosystem {
       check(prod3 != _gnode.end(), "account not in _gnode");
       regproducer(new_producer, prod3->producer_key, url, prod3->location);
 
-      auto idx = _producers.get_index<"prototalvote"_n>();
-
+      /// inactive producers sort last, so the schedule holds every active producer
       std::vector< std::pair<eosio::producer_key,uint16_t> > top_producers;
-      uint16_t new_size = get_producers_size(); //原有数量加一
-      top_producers.reserve( new_size );
-
-      for ( auto it = idx.cbegin(); it != idx.cend() && top_producers.size() < new_size && it->active(); ++it ) {
-         top_producers.emplace_back( std::pair<eosio::producer_key,uint16_t>({{it->owner, it->producer_key}, it->location}) );
-      }
-
-      /// sort by producer name
-      std::sort( top_producers.begin(), top_producers.end() );
-
-      std::vector<eosio::producer_key> producers;
 
-      producers.reserve(top_producers.size());
-      for( const auto& item : top_producers )
-         producers.push_back(item.first);
-
-      auto packed_schedule = pack(producers);
+      for_each_producer_by_votes( [&]( const auto& p ) {
+         if ( !p.active() )
+            return false;
+         const auto& info = _producers.get( p.owner.value, "producer not found" );
+         top_producers.emplace_back( std::pair<eosio::producer_key,uint16_t>({{info.owner, info.producer_key}, info.location}) );
+         return true;
+      });
 
-      if( set_proposed_producers( packed_schedule.data(),  packed_schedule.size() ) >= 0 ) {
-         _gstate.last_producer_schedule_size = static_cast<decltype(_gstate.last_producer_schedule_size)>( top_producers.size() );
-      }
+      propose_producers( top_producers );
 
       // 更新 proposals_table _proposals
       const auto& proposal_voting = _proposals.get(proposal_id, "proposal not exist");
@@ -160,40 +268,24 @@ namespace eosiosystem {
    // 提案type==2，将account 从producer移除
    void system_contract::remove_elected_producers( name remove_producer, uint64_t proposal_id ) {
 
-      auto idx = _producers.get_index<"prototalvote"_n>();
       // remove_producer是否在bp中
-      bool isExist = false;
-      for ( auto it = idx.cbegin(); it != idx.cend(); ++it ) {
-         if(remove_producer.value == it->owner.value) {
-            isExist = true;
-            break;
-         }
-      }
-      if( !isExist ) return;
+      if( _producers.find( remove_producer.value ) == _producers.end() ) return;
 
+      /// inactive producers sort last and remove_producer is one of the rows, so every other
+      /// active producer fits in the reduced schedule without counting the table first
       std::vector< std::pair<eosio::producer_key,uint16_t> > top_producers;
-      uint16_t new_size = get_producers_size() - 1; //原有数量加一
-      top_producers.reserve(new_size);
-
-      for ( auto it = idx.cbegin(); it != idx.cend() && top_producers.size() < new_size && it->active(); ++it ) {
-         if(remove_producer.value != it->owner.value)
-            top_producers.emplace_back( std::pair<eosio::producer_key,uint16_t>({{it->owner, it->producer_key}, it->location}) );
-      }
-
-      /// sort by producer name
-      std::sort( top_producers.begin(), top_producers.end() );
 
-      std::vector<eosio::producer_key> producers;
-
-      producers.reserve(top_producers.size());
-      for( const auto& item : top_producers )
-         producers.push_back(item.first);
-
-      auto packed_schedule = pack(producers);
+      for_each_producer_by_votes( [&]( const auto& p ) {
+         if ( !p.active() )
+            return false;
+         if ( remove_producer != p.owner ) {
+            const auto& info = _producers.get( p.owner.value, "producer not found" );
+            top_producers.emplace_back( std::pair<eosio::producer_key,uint16_t>({{info.owner, info.producer_key}, info.location}) );
+         }
+         return true;
+      });
 
-      if( set_proposed_producers( packed_schedule.data(),  packed_schedule.size() ) >= 0 ) {
-         _gstate.last_producer_schedule_size = static_cast<decltype(_gstate.last_producer_schedule_size)>( top_producers.size() );
-      }
+      propose_producers( top_producers );
 
       // 更新 proposals_table _proposals
       const auto& proposal_voting = _proposals.get(proposal_id, "proposal not exist");
@@ -260,6 +352,138 @@ namespace eosiosystem {
       return new_votepay_share;
    }
 
+   void system_contract::update_total_votepay_share( time_point ct, const votepay_share_delta& vpay_delta ) {
+      if( _gstate4.votepay_fixed_point ) {
+         update_total_votepay_share_fp( ct, -vpay_delta.inactive_share_fp, vpay_delta.change_rate_fp );
+      } else {
+         update_total_votepay_share( ct, -vpay_delta.inactive_share, vpay_delta.change_rate );
+      }
+   }
+
+   uint128_t system_contract::update_total_votepay_share_fp( time_point ct,
+                                                             int128_t additional_shares_delta,
+                                                             int128_t shares_rate_delta )
+   {
+      if( ct > _gstate3.last_vpay_state_update ) {
+         _gstate4.total_votepay_share += _gstate4.vpay_share_change_rate
+                                         * uint128_t( (ct - _gstate3.last_vpay_state_update).count() );
+      }
+
+      if( additional_shares_delta < 0 && _gstate4.total_votepay_share < uint128_t(-additional_shares_delta) ) {
+         _gstate4.total_votepay_share = 0;
+      } else {
+         _gstate4.total_votepay_share += additional_shares_delta;
+      }
+
+      if( shares_rate_delta < 0 && _gstate4.vpay_share_change_rate < uint128_t(-shares_rate_delta) ) {
+         _gstate4.vpay_share_change_rate = 0;
+      } else {
+         _gstate4.vpay_share_change_rate += shares_rate_delta;
+      }
+
+      _gstate3.last_vpay_state_update = ct;
+
+      return _gstate4.total_votepay_share;
+   }
+
+   uint128_t system_contract::update_producer_votepay_share_fp( const producer_votepay_table::const_iterator& prod_itr,
+                                                                time_point ct,
+                                                                uint128_t shares_rate,
+                                                                bool reset_to_zero )
+   {
+      uint128_t new_votepay_share = prod_itr->votepay_share;
+      if( shares_rate > 0 && ct > prod_itr->last_votepay_share_update ) {
+         new_votepay_share += shares_rate * uint128_t( (ct - prod_itr->last_votepay_share_update).count() );
+      }
+
+      _prodvpay.modify( prod_itr, same_payer, [&](auto& p) {
+         p.votepay_share             = reset_to_zero ? 0 : new_votepay_share;
+         p.last_votepay_share_update = ct;
+      } );
+
+      return new_votepay_share;
+   }
+
+   void system_contract::recompvpay() {
+      require_auth( _self );
+
+      const auto ct = current_time_point();
+      double    change_rate    = 0.0;
+      uint128_t change_rate_fp = 0;
+      auto recompute = [&]( const name& owner ) {
+         auto prod3 = find_producer3( owner );
+         check( prod3 != _producers3.end(), "producer not found" ); //data corruption
+         /// producers accumulate votepay_share until 3 days after their last claim
+         if( ct < prod3->last_claim_time + microseconds(3 * useconds_per_day) ) {
+            change_rate    += prod3->total_votes;
+            change_rate_fp += static_cast<uint128_t>( prod3->total_votes );
+         }
+      };
+
+      if( _gstate4.votepay_fixed_point ) {
+         for( auto vpay = _prodvpay.begin(); vpay != _prodvpay.end(); ++vpay ) {
+            recompute( vpay->owner );
+            _prodvpay.modify( vpay, same_payer, [&]( auto& p ) {
+               p.votepay_share             = 0;
+               p.last_votepay_share_update = ct;
+            });
+         }
+         _gstate4.total_votepay_share    = 0;
+         _gstate4.vpay_share_change_rate = change_rate_fp;
+      } else {
+         for( auto prod2 = _producers2.begin(); prod2 != _producers2.end(); ++prod2 ) {
+            recompute( prod2->owner );
+            _producers2.modify( prod2, same_payer, [&]( auto& p ) {
+               p.votepay_share             = 0.0;
+               p.last_votepay_share_update = ct;
+            });
+         }
+         _gstate2.total_producer_votepay_share = 0.0;
+         _gstate3.total_vpay_share_change_rate = change_rate;
+      }
+      _gstate3.last_vpay_state_update = ct;
+   }
+
+   /**
+    *  Moves votepay_share from producers2 to prodvpay. Each share is converted to vote microseconds
+    *  and the votes of each producer to whole votes by truncation, the totals are the sums of the
+    *  truncated values so that they match the prodvpay rows exactly.
+    */
+   void system_contract::convertvpay() {
+      require_auth( _self );
+      check( !_gstate4.votepay_fixed_point, "votepay share is already fixed point" );
+
+      const auto ct = current_time_point();
+      uint128_t total_votepay_share = 0;
+      uint128_t change_rate         = 0;
+      for( auto prod2 = _producers2.begin(); prod2 != _producers2.end(); ) {
+         auto prod3 = find_producer3( prod2->owner );
+         check( prod3 != _producers3.end(), "producer not found" ); //data corruption
+         const uint128_t votepay_share = static_cast<uint128_t>( prod2->votepay_share * 1E6 );
+         total_votepay_share += votepay_share;
+         /// producers not updated since 3 days after their last claim still accumulate votepay_share
+         if( prod2->last_votepay_share_update < prod3->last_claim_time + microseconds(3 * useconds_per_day) ) {
+            const uint128_t votes = static_cast<uint128_t>( prod3->total_votes );
+            change_rate         += votes;
+            total_votepay_share += votes * uint128_t( (ct - prod2->last_votepay_share_update).count() );
+         }
+
+         _prodvpay.emplace( prod2->owner, [&]( auto& p ) {
+            p.owner                     = prod2->owner;
+            p.votepay_share             = votepay_share;
+            p.last_votepay_share_update = prod2->last_votepay_share_update;
+         });
+         prod2 = _producers2.erase( prod2 );
+      }
+
+      _gstate4.total_votepay_share    = total_votepay_share;
+      _gstate4.vpay_share_change_rate = change_rate;
+      _gstate4.votepay_fixed_point    = true;
+      _gstate2.total_producer_votepay_share = 0.0;
+      _gstate3.total_vpay_share_change_rate = 0.0;
+      _gstate3.last_vpay_state_update       = ct;
+   }
+
 
    // 对提案投票
    void system_contract::voteproposal( const name voter_name, const uint64_t proposal_id, const bool yea ) {
@@ -271,18 +495,31 @@ namespace eosiosystem {
 
       const auto& proposal_voting = _proposals.get(proposal_id, "proposal not exist");
 
-      proposal_vote_table pvotes(_self, proposal_id);
+      auto voter = read_voter( voter_name );
+      check( voter.has_value(), "user must stake before they can vote" );
+      int64_t pvote_weight = stake_to_proposal_votes( voter->staked );
+
+      proposal_votes_table pvotes(_self, proposal_id);
       auto vote_info = pvotes.find(voter_name.value);
 
-      auto voter = _voters.find( voter_name.value );
-      int64_t pvote_weight = stake_to_proposal_votes( voter->staked );
+      /// votes cast before the compact layout are converted when the voter votes again
+      if (vote_info == pvotes.end() && has_legacy_proposal_votes(proposal_id)) {
+          proposal_vote_table old_votes(_self, proposal_id);
+          auto old_vote = old_votes.find(voter_name.value);
+          if (old_vote != old_votes.end()) {
+              vote_info = pvotes.emplace(voter_name, [&](auto &info) {
+                  info.owner = voter_name;
+                  info.set_vote(old_vote->vote, proposal_voting.start_time, old_vote->vote_time);
+              });
+              old_votes.erase(old_vote);
+          }
+      }
 
       if (vote_info != pvotes.end()) {
-          bool old_vote = vote_info->vote;
+          bool old_vote = vote_info->yea();
           if (yea != old_vote) {
               pvotes.modify(vote_info, voter_name, [&](auto &info) {
-                  info.vote = yea;
-                  info.vote_time = ct;
+                  info.set_vote(yea, proposal_voting.start_time, ct);
               });
               _proposals.modify(proposal_voting, voter_name, [&](auto &info) {
                   if (yea) {
@@ -300,8 +537,7 @@ namespace eosiosystem {
           // RAM is from voter, so they need have some to vote
           pvotes.emplace(voter_name, [&](auto &info) {
               info.owner = voter_name;
-              info.vote = yea;
-              info.vote_time = ct;
+              info.set_vote(yea, proposal_voting.start_time, ct);
           });
           _proposals.modify(proposal_voting, voter_name, [&](auto &info) {
               if (yea) {
@@ -313,6 +549,59 @@ namespace eosiosystem {
       }
    }
 
+   /**
+    *  Returns the vote of voter_name on a proposal in either vote layout, empty if it did not vote.
+    */
+   std::optional<bool> system_contract::get_proposal_vote( uint64_t proposal_id, const name& voter_name )const {
+      proposal_votes_table pvotes(_self, proposal_id);
+      auto vote_info = pvotes.find(voter_name.value);
+      if (vote_info != pvotes.end())
+         return vote_info->yea();
+
+      if (!has_legacy_proposal_votes(proposal_id))
+         return {};
+
+      proposal_vote_table old_votes(_self, proposal_id);
+      auto old_vote = old_votes.find(voter_name.value);
+      if (old_vote != old_votes.end())
+         return old_vote->vote;
+      return {};
+   }
+
+   /**
+    *  Returns false if the proposal is known to have no votes in the propvote layout.
+    */
+   bool system_contract::has_legacy_proposal_votes( uint64_t proposal_id )const {
+      return !_gstate4.proposal_votes_migrated && _gstate4.next_migrated_proposal <= proposal_id;
+   }
+
+   void system_contract::migratepvote( uint16_t max ) {
+      check( !_gstate4.proposal_votes_migrated, "proposal votes are already migrated" );
+      check( 0 < max, "must migrate at least one vote" );
+
+      auto prop = _proposals.lower_bound( _gstate4.next_migrated_proposal );
+      for( ; prop != _proposals.end() && 0 < max; ++prop ) {
+         proposal_vote_table  old_votes( _self, prop->id );
+         proposal_votes_table pvotes( _self, prop->id );
+         auto itr = old_votes.begin();
+         for( ; itr != old_votes.end() && 0 < max; --max ) {
+            if( pvotes.find( itr->owner.value ) == pvotes.end() ) {
+               /// the voter paid for the old row and pays for the smaller new one
+               pvotes.emplace( itr->owner, [&]( auto& info ) {
+                  info.owner = itr->owner;
+                  info.set_vote( itr->vote, prop->start_time, itr->vote_time );
+               });
+            }
+            itr = old_votes.erase( itr );
+         }
+         if( itr != old_votes.end() )
+            break;
+         _gstate4.next_migrated_proposal = prop->id + 1;
+      }
+      if( prop == _proposals.end() )
+         _gstate4.proposal_votes_migrated = true;
+   }
+
 
    // 账号抵押的cpu&net映射为票数
    // t个EON换票计算：t/100 + t/1000 + t/10000 + t/100000 + t/1000000 + ...
@@ -360,14 +649,14 @@ namespace eosiosystem {
          check( producers.size() == 0, "cannot vote for producers and proxy at same time" );
          check( voter_name != proxy, "cannot proxy to self" );
       } else {
-         check( producers.size() <= 30, "attempt to vote for too many producers" );
+         check( producers.size() <= max_producer_votes, "attempt to vote for too many producers" );
          for( size_t i = 1; i < producers.size(); ++i ) {
             check( producers[i-1] < producers[i], "producer votes must be unique and sorted" );
          }
       }
 
-      auto voter = _voters.find( voter_name.value );
-      check( voter != _voters.end(), "user must stake before they can vote" ); /// staking creates voter object
+      auto voter = find_voter2( voter_name );
+      check( voter != _voters2.end(), "user must stake before they can vote" ); /// staking creates voter object
       check( !proxy || !voter->is_proxy, "account registered as a proxy is not allowed to use a proxy" );
 
       /**
@@ -387,92 +676,117 @@ namespace eosiosystem {
          new_vote_weight += voter->proxied_vote_weight;
       }
 
-      boost::container::flat_map<name, pair<double, bool /*new*/> > producer_deltas;
-      if ( voter->last_vote_weight > 0 ) {
-         if( voter->proxy ) {
-            auto old_proxy = _voters.find( voter->proxy.value );
-            check( old_proxy != _voters.end(), "old proxy not found" ); //data corruption
-            _voters.modify( old_proxy, same_payer, [&]( auto& vp ) {
-                  vp.proxied_vote_weight -= voter->last_vote_weight;
-               });
-            propagate_weight_change( *old_proxy );
-         } else {
-            for( const auto& p : voter->producers ) {
-               auto& d = producer_deltas[p];
-               d.first -= voter->last_vote_weight;
-               d.second = false;
-            }
-         }
+      /// a stake change revotes the stored producers, which the caller has already read
+      std::vector<name> stored_producers;
+      if( voting ) {
+         stored_producers = get_voter_producers( *voter );
+      }
+      const auto& old_producers = voting ? stored_producers : producers;
+
+      /// both producer lists are sorted, so the deltas are merged into a sorted buffer in one pass
+      struct producer_delta {
+         name   producer;
+         double vote_delta = 0.0;
+         bool   is_new     = false;
+      };
+      std::array<producer_delta, 2 * max_producer_votes> producer_deltas;
+      size_t num_deltas = 0;
+
+      const bool remove_old = voter->last_vote_weight > 0 && !voter->proxy;
+      const bool add_new    = !proxy && new_vote_weight >= 0;
+      if ( voter->last_vote_weight > 0 && voter->proxy ) {
+         auto old_proxy = find_voter2( voter->proxy );
+         check( old_proxy != _voters2.end(), "old proxy not found" ); //data corruption
+         _voters2.modify( old_proxy, same_payer, [&]( auto& vp ) {
+               vp.proxied_vote_weight -= voter->last_vote_weight;
+            });
+         mark_proxy_dirty( voter->proxy );
       }
 
       if( proxy ) {
-         auto new_proxy = _voters.find( proxy.value );
-         check( new_proxy != _voters.end(), "invalid proxy specified" ); //if ( !voting ) { data corruption } else { wrong vote }
+         auto new_proxy = find_voter2( proxy );
+         check( new_proxy != _voters2.end(), "invalid proxy specified" ); //if ( !voting ) { data corruption } else { wrong vote }
          check( !voting || new_proxy->is_proxy, "proxy not found" );
          if ( new_vote_weight >= 0 ) {
-            _voters.modify( new_proxy, same_payer, [&]( auto& vp ) {
+            _voters2.modify( new_proxy, same_payer, [&]( auto& vp ) {
                   vp.proxied_vote_weight += new_vote_weight;
                });
-            propagate_weight_change( *new_proxy );
+            mark_proxy_dirty( proxy );
          }
-      } else {
-         if( new_vote_weight >= 0 ) {
-            for( const auto& p : producers ) {
-               auto& d = producer_deltas[p];
-               d.first += new_vote_weight;
-               d.second = true;
+      }
+
+      {
+         const size_t num_old = remove_old ? old_producers.size() : 0;
+         const size_t num_new = add_new ? producers.size() : 0;
+         check( num_old + num_new <= producer_deltas.size(), "too many producer vote changes" ); //data corruption
+         size_t i = 0, j = 0;
+         while( i < num_old || j < num_new ) {
+            auto& d = producer_deltas[num_deltas++];
+            if( j == num_new || (i < num_old && old_producers[i] < producers[j]) ) {
+               d.producer   = old_producers[i++];
+               d.vote_delta = -voter->last_vote_weight;
+            } else if( i == num_old || producers[j] < old_producers[i] ) {
+               d.producer   = producers[j++];
+               d.vote_delta = new_vote_weight;
+               d.is_new     = true;
+            } else {
+               d.producer   = producers[j++];
+               d.vote_delta = -voter->last_vote_weight;
+               d.vote_delta += new_vote_weight;
+               d.is_new     = true;
+               ++i;
             }
          }
       }
 
       const auto ct = current_time_point();
-      double delta_change_rate         = 0.0;
-      double total_inactive_vpay_share = 0.0;
-      for( const auto& pd : producer_deltas ) {
-         auto pitr = _producers.find( pd.first.value );
-         if( pitr != _producers.end() ) {
-            check( !voting || pitr->active() || !pd.second.second /* not from new set */, "producer is not currently registered" );
-            double init_total_votes = pitr->total_votes;
-            _producers.modify( pitr, same_payer, [&]( auto& p ) {
-               p.total_votes += pd.second.first;
-               if ( p.total_votes < 0 ) { // floating point arithmetics can give small negative numbers
-                  p.total_votes = 0;
-               }
-               _gstate.total_producer_vote_weight += pd.second.first;
-               //check( p.total_votes >= 0, "something bad happened" );
-            });
-            auto prod2 = _producers2.find( pd.first.value );
-            if( prod2 != _producers2.end() ) {
-               const auto last_claim_plus_3days = pitr->last_claim_time + microseconds(3 * useconds_per_day);
-               bool crossed_threshold       = (last_claim_plus_3days <= ct);
-               bool updated_after_threshold = (last_claim_plus_3days <= prod2->last_votepay_share_update);
-               // Note: updated_after_threshold implies cross_threshold
-
-               double new_votepay_share = update_producer_votepay_share( prod2,
-                                             ct,
-                                             updated_after_threshold ? 0.0 : init_total_votes,
-                                             crossed_threshold && !updated_after_threshold // only reset votepay_share once after threshold
-                                          );
-
-               if( !crossed_threshold ) {
-                  delta_change_rate += pd.second.first;
-               } else if( !updated_after_threshold ) {
-                  total_inactive_vpay_share += new_votepay_share;
-                  delta_change_rate -= init_total_votes;
-               }
+      votepay_share_delta vpay_delta;
+      for( size_t k = 0; k < num_deltas; ++k ) {
+         const auto& pd = producer_deltas[k];
+         auto pitr = find_producer3( pd.producer );
+         if( pitr != _producers3.end() ) {
+            check( !voting || pitr->active() || !pd.is_new /* not from new set */, "producer is not currently registered" );
+            if( _gstate4.defer_vote_deltas ) {
+               queue_producer_votes( pd.producer, pd.vote_delta );
+            } else {
+               add_producer_votes( pitr, pd.vote_delta, ct, vpay_delta );
             }
          } else {
-            check( !pd.second.second /* not from new set */, "producer is not registered" ); //data corruption
+            check( !pd.is_new /* not from new set */, "producer is not registered" ); //data corruption
          }
       }
 
-      update_total_votepay_share( ct, -total_inactive_vpay_share, delta_change_rate );
+#if TRACK_PRODUCER_VOTEPAY_SHARE
+      update_total_votepay_share( ct, vpay_delta );
+#endif
 
-      _voters.modify( voter, same_payer, [&]( auto& av ) {
+      _voters2.modify( voter, same_payer, [&]( auto& av ) {
          av.last_vote_weight = new_vote_weight;
-         av.producers = producers;
-         av.proxy     = proxy;
+         av.num_producers    = static_cast<uint8_t>( producers.size() );
+         av.proxy            = proxy;
       });
+      /// the vote of a proxy includes all of its proxied weight
+      if( voter->is_proxy ) {
+         clear_proxy_dirty( voter_name );
+      }
+
+      /// the producers list is only rewritten when the vote itself changes
+      if( voting && producers != old_producers ) {
+         auto pitr = _voterprods.find( voter_name.value );
+         if( producers.empty() ) {
+            if( pitr != _voterprods.end() )
+               _voterprods.erase( pitr );
+         } else if( pitr == _voterprods.end() ) {
+            _voterprods.emplace( voter_name, [&]( auto& vp ) {
+               vp.owner     = voter_name;
+               vp.producers = producers;
+            });
+         } else {
+            _voterprods.modify( pitr, same_payer, [&]( auto& vp ) {
+               vp.producers = producers;
+            });
+         }
+      }
    }
 
    /**
@@ -487,23 +801,198 @@ namespace eosiosystem {
    void system_contract::regproxy( const name proxy, bool isproxy ) {
       require_auth( proxy );
 
-      auto pitr = _voters.find( proxy.value );
-      if ( pitr != _voters.end() ) {
+      auto pitr = find_voter2( proxy );
+      if ( pitr != _voters2.end() ) {
          check( isproxy != pitr->is_proxy, "action has no effect" );
          check( !isproxy || !pitr->proxy, "account that uses a proxy is not allowed to become a proxy" );
-         _voters.modify( pitr, same_payer, [&]( auto& p ) {
+         _voters2.modify( pitr, same_payer, [&]( auto& p ) {
                p.is_proxy = isproxy;
             });
          propagate_weight_change( *pitr );
       } else {
-         _voters.emplace( proxy, [&]( auto& p ) {
+         _voters2.emplace( proxy, [&]( auto& p ) {
                p.owner  = proxy;
                p.is_proxy = isproxy;
             });
       }
    }
 
-   void system_contract::propagate_weight_change( const voter_info& voter ) {
+   /**
+    *  Finds the compact row of a voter, converting its voter_info row if it has not been
+    *  converted yet. Returns end if the account has never staked or voted.
+    */
+   voters_table2::const_iterator system_contract::find_voter2( const name& owner ) {
+      auto itr = _voters2.find( owner.value );
+      if( itr != _voters2.end() )
+         return itr;
+
+      auto old = _voters.find( owner.value );
+      if( old == _voters.end() )
+         return itr;
+
+      if( !old->producers.empty() ) {
+         _voterprods.emplace( owner, [&]( auto& vp ) {
+            vp.owner     = owner;
+            vp.producers = old->producers;
+         });
+      }
+      itr = _voters2.emplace( owner, [&]( auto& v ) {
+         v.owner               = owner;
+         v.proxy               = old->proxy;
+         v.staked              = old->staked;
+         v.last_vote_weight    = old->last_vote_weight;
+         v.proxied_vote_weight = old->proxied_vote_weight;
+         v.is_proxy            = old->is_proxy;
+         v.num_producers       = static_cast<uint8_t>( old->producers.size() );
+         v.flags1              = old->flags1;
+      });
+      _voters.erase( old );
+      return itr;
+   }
+
+   /**
+    *  Reads a voter without converting it, from the compact row if there is one.
+    */
+   std::optional<voter_info2> system_contract::read_voter( const name& owner )const {
+      auto itr = _voters2.find( owner.value );
+      if( itr != _voters2.end() )
+         return *itr;
+
+      auto old = _voters.find( owner.value );
+      if( old == _voters.end() )
+         return {};
+
+      voter_info2 v;
+      v.owner               = owner;
+      v.proxy               = old->proxy;
+      v.staked              = old->staked;
+      v.last_vote_weight    = old->last_vote_weight;
+      v.proxied_vote_weight = old->proxied_vote_weight;
+      v.is_proxy            = old->is_proxy;
+      v.num_producers       = static_cast<uint8_t>( old->producers.size() );
+      v.flags1              = old->flags1;
+      return v;
+   }
+
+   std::vector<name> system_contract::get_voter_producers( const voter_info2& voter )const {
+      if( voter.num_producers == 0 )
+         return {};
+      return _voterprods.get( voter.owner.value, "voted producers not found" ).producers; //data corruption
+   }
+
+   void system_contract::add_producer_votes( const producers_table3::const_iterator& pitr, double delta, time_point ct,
+                                            votepay_share_delta& vpay_delta ) {
+#if TRACK_PRODUCER_VOTEPAY_SHARE
+      const double init_total_votes = pitr->total_votes;
+#endif
+      modify_producer3( pitr, [&]( auto& p ) {
+         p.total_votes += delta;
+         if ( p.total_votes < 0 ) { // floating point arithmetics can give small negative numbers
+            p.total_votes = 0;
+         }
+         //check( p.total_votes >= 0, "something bad happened" );
+      });
+      _gstate.total_producer_vote_weight += delta;
+#if TRACK_PRODUCER_VOTEPAY_SHARE
+      const auto last_claim_plus_3days = pitr->last_claim_time + microseconds(3 * useconds_per_day);
+      bool crossed_threshold = (last_claim_plus_3days <= ct);
+      if( _gstate4.votepay_fixed_point ) {
+         auto vpay = _prodvpay.find( pitr->owner.value );
+         if( vpay != _prodvpay.end() ) {
+            bool updated_after_threshold = (last_claim_plus_3days <= vpay->last_votepay_share_update);
+            // Note: updated_after_threshold implies cross_threshold
+
+            /// the votes are truncated to whole votes once, the shares are accumulated in integers
+            const int128_t init_votes = static_cast<int128_t>( init_total_votes );
+            uint128_t new_votepay_share = update_producer_votepay_share_fp( vpay,
+                                             ct,
+                                             updated_after_threshold ? 0 : init_votes,
+                                             crossed_threshold && !updated_after_threshold // only reset votepay_share once after threshold
+                                          );
+
+            if( !crossed_threshold ) {
+               vpay_delta.change_rate_fp += static_cast<int128_t>( pitr->total_votes ) - init_votes;
+            } else if( !updated_after_threshold ) {
+               vpay_delta.inactive_share_fp += new_votepay_share;
+               vpay_delta.change_rate_fp    -= init_votes;
+            }
+         }
+         return;
+      }
+
+      auto prod2 = _producers2.find( pitr->owner.value );
+      if( prod2 != _producers2.end() ) {
+         bool updated_after_threshold = (last_claim_plus_3days <= prod2->last_votepay_share_update);
+         // Note: updated_after_threshold implies cross_threshold
+
+         double new_votepay_share = update_producer_votepay_share( prod2,
+                                       ct,
+                                       updated_after_threshold ? 0.0 : init_total_votes,
+                                       crossed_threshold && !updated_after_threshold // only reset votepay_share once after threshold
+                                    );
+
+         if( !crossed_threshold ) {
+            vpay_delta.change_rate += delta;
+         } else if( !updated_after_threshold ) {
+            vpay_delta.inactive_share += new_votepay_share;
+            vpay_delta.change_rate    -= init_total_votes;
+         }
+      }
+#endif
+   }
+
+   /**
+    *  Adds delta to the queued vote change of producer, the row is paid by the system contract
+    *  and freed when the change is applied. A vote still touches one queued row per producer, what
+    *  it skips is the producers3 row and its votes index update.
+    */
+   void system_contract::queue_producer_votes( const name& producer, double delta ) {
+      auto itr = _votedeltas.find( producer.value );
+      if( itr == _votedeltas.end() ) {
+         _votedeltas.emplace( _self, [&]( auto& d ) {
+            d.owner      = producer;
+            d.vote_delta = delta;
+         });
+      } else {
+         _votedeltas.modify( itr, same_payer, [&]( auto& d ) {
+            d.vote_delta += delta;
+         });
+      }
+   }
+
+   /**
+    *  Applies up to max queued vote changes, returns true once no changes are left.
+    */
+   bool system_contract::apply_vote_deltas( uint16_t max ) {
+      auto itr = _votedeltas.begin();
+      if( itr == _votedeltas.end() )
+         return true;
+
+      const auto ct = current_time_point();
+      votepay_share_delta vpay_delta;
+      for( ; itr != _votedeltas.end() && 0 < max; --max ) {
+         auto pitr = find_producer3( itr->owner );
+         if( pitr != _producers3.end() )
+            add_producer_votes( pitr, itr->vote_delta, ct, vpay_delta );
+         itr = _votedeltas.erase( itr );
+      }
+#if TRACK_PRODUCER_VOTEPAY_SHARE
+      update_total_votepay_share( ct, vpay_delta );
+#endif
+      return itr == _votedeltas.end();
+   }
+
+   void system_contract::setvotedefer( bool defer ) {
+      require_auth( _self );
+
+      check( defer != _gstate4.defer_vote_deltas, "vote delta mode is unchanged" );
+      if( !defer ) {
+         check( apply_vote_deltas( std::numeric_limits<uint16_t>::max() ), "too many queued vote changes" );
+      }
+      _gstate4.defer_vote_deltas = defer;
+   }
+
+   void system_contract::propagate_weight_change( const voter_info2& voter ) {
       check( !voter.proxy || !voter.is_proxy, "account registered as a proxy is not allowed to use a proxy" );
       double new_weight = stake2vote( voter.staked );
       if ( voter.is_proxy ) {
@@ -513,53 +1002,85 @@ namespace eosiosystem {
       /// don't propagate small changes (1 ~= epsilon)
       if ( fabs( new_weight - voter.last_vote_weight ) > 1 )  {
          if ( voter.proxy ) {
-            auto& proxy = _voters.get( voter.proxy.value, "proxy not found" ); //data corruption
-            _voters.modify( proxy, same_payer, [&]( auto& p ) {
+            auto proxy = find_voter2( voter.proxy );
+            check( proxy != _voters2.end(), "proxy not found" ); //data corruption
+            _voters2.modify( proxy, same_payer, [&]( auto& p ) {
                   p.proxied_vote_weight += new_weight - voter.last_vote_weight;
                }
             );
-            propagate_weight_change( proxy );
+            mark_proxy_dirty( voter.proxy );
          } else {
             auto delta = new_weight - voter.last_vote_weight;
             const auto ct = current_time_point();
-            double delta_change_rate         = 0;
-            double total_inactive_vpay_share = 0;
-            for ( auto acnt : voter.producers ) {
-               auto& prod = _producers.get( acnt.value, "producer not found" ); //data corruption
-               const double init_total_votes = prod.total_votes;
-               _producers.modify( prod, same_payer, [&]( auto& p ) {
-                  p.total_votes += delta;
-                  _gstate.total_producer_vote_weight += delta;
-               });
-               auto prod2 = _producers2.find( acnt.value );
-               if ( prod2 != _producers2.end() ) {
-                  const auto last_claim_plus_3days = prod.last_claim_time + microseconds(3 * useconds_per_day);
-                  bool crossed_threshold       = (last_claim_plus_3days <= ct);
-                  bool updated_after_threshold = (last_claim_plus_3days <= prod2->last_votepay_share_update);
-                  // Note: updated_after_threshold implies cross_threshold
-
-                  double new_votepay_share = update_producer_votepay_share( prod2,
-                                                ct,
-                                                updated_after_threshold ? 0.0 : init_total_votes,
-                                                crossed_threshold && !updated_after_threshold // only reset votepay_share once after threshold
-                                             );
-
-                  if( !crossed_threshold ) {
-                     delta_change_rate += delta;
-                  } else if( !updated_after_threshold ) {
-                     total_inactive_vpay_share += new_votepay_share;
-                     delta_change_rate -= init_total_votes;
-                  }
+            votepay_share_delta vpay_delta;
+            for ( auto acnt : get_voter_producers( voter ) ) {
+               auto pitr = find_producer3( acnt );
+               check( pitr != _producers3.end(), "producer not found" ); //data corruption
+               if( _gstate4.defer_vote_deltas ) {
+                  queue_producer_votes( acnt, delta );
+               } else {
+                  add_producer_votes( pitr, delta, ct, vpay_delta );
                }
             }
 
-            update_total_votepay_share( ct, -total_inactive_vpay_share, delta_change_rate );
+#if TRACK_PRODUCER_VOTEPAY_SHARE
+            update_total_votepay_share( ct, vpay_delta );
+#endif
          }
       }
-      _voters.modify( voter, same_payer, [&]( auto& v ) {
+      _voters2.modify( voter, same_payer, [&]( auto& v ) {
             v.last_vote_weight = new_weight;
          }
       );
+      if ( voter.is_proxy ) {
+         clear_proxy_dirty( voter.owner );
+      }
+   }
+
+   /**
+    *  Marks proxy as having proxied vote weight which is not yet pushed to its producers,
+    *  the weight is pushed by refreshproxy or by onblock.
+    */
+   void system_contract::mark_proxy_dirty( const name& proxy ) {
+      if( _dirtyproxies.find( proxy.value ) == _dirtyproxies.end() ) {
+         _dirtyproxies.emplace( _self, [&]( auto& d ) {
+            d.owner = proxy;
+         });
+      }
+   }
+
+   void system_contract::clear_proxy_dirty( const name& proxy ) {
+      auto itr = _dirtyproxies.find( proxy.value );
+      if( itr != _dirtyproxies.end() )
+         _dirtyproxies.erase( itr );
+   }
+
+   /**
+    *  Pushes the pending proxied vote weight of up to max proxies to their producers. This runs in
+    *  onblock and must not fail, entries of accounts which are no longer proxies are dropped.
+    */
+   void system_contract::refresh_dirty_proxies( uint16_t max ) {
+      for( auto itr = _dirtyproxies.begin(); itr != _dirtyproxies.end() && 0 < max; --max ) {
+         auto pitr = find_voter2( itr->owner );
+         if( pitr == _voters2.end() || !pitr->is_proxy ) {
+            itr = _dirtyproxies.erase( itr );
+            continue;
+         }
+         ++itr;
+         propagate_weight_change( *pitr ); /// clears the entry of the proxy
+      }
+   }
+
+   void system_contract::refreshproxy( const name proxy ) {
+      auto itr = _dirtyproxies.find( proxy.value );
+      check( itr != _dirtyproxies.end(), "proxy has no pending vote weight" );
+      auto pitr = find_voter2( proxy );
+      check( pitr != _voters2.end(), "proxy not found" ); //data corruption
+      if( pitr->is_proxy ) {
+         propagate_weight_change( *pitr ); /// clears the entry of the proxy
+      } else {
+         _dirtyproxies.erase( itr );
+      }
    }
 
 } /// namespace eosiosystem
@@ -8,6 +8,28 @@
 #include <eosiolib/eosio.hpp>
 
 #include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/**
+ *  When CORE_SYMBOL_NAME is defined, transfers of that symbol check their precision against
+ *  CORE_SYMBOL_PRECISION instead of reading the stat row. Other symbols always read it.
+ */
+#ifdef CORE_SYMBOL_NAME
+#ifndef CORE_SYMBOL_PRECISION
+#define CORE_SYMBOL_PRECISION 4
+#endif
+#endif
+
+/**
+ *  When ISSUE_VIA_INLINE_TRANSFER is 1, issue credits the issuer and sends an inline transfer to
+ *  the recipient as it used to, for indexers that expect that trace. By default the recipient
+ *  is credited and notified directly by issue.
+ */
+#ifndef ISSUE_VIA_INLINE_TRANSFER
+#define ISSUE_VIA_INLINE_TRANSFER 0
+#endif
 
 namespace eosiosystem {
    class system_contract;
@@ -37,6 +59,11 @@ namespace eosio {
                         asset   quantity,
                         string  memo );
 
+         [[eosio::action]]
+         void transfern( name                                      from,
+                         const std::vector<std::pair<name,asset>>& transfers,
+                         string                                    memo );
+
          [[eosio::action]]
          void open( name owner, const symbol& symbol, name ram_payer );
 
@@ -57,10 +84,17 @@ namespace eosio {
             return ac.balance;
          }
 
+         /**
+          *  Dispatches transfer, issue or retire with the memo checked in place in the action data
+          *  instead of being unpacked into a string.
+          */
+         static void dispatch_memo_action( name receiver, name code, name action );
+
          using create_action = eosio::action_wrapper<"create"_n, &token::create>;
          using issue_action = eosio::action_wrapper<"issue"_n, &token::issue>;
          using retire_action = eosio::action_wrapper<"retire"_n, &token::retire>;
          using transfer_action = eosio::action_wrapper<"transfer"_n, &token::transfer>;
+         using transfern_action = eosio::action_wrapper<"transfern"_n, &token::transfern>;
          using open_action = eosio::action_wrapper<"open"_n, &token::open>;
          using close_action = eosio::action_wrapper<"close"_n, &token::close>;
       private:
@@ -81,6 +115,15 @@ namespace eosio {
          typedef eosio::multi_index< "accounts"_n, account > accounts;
          typedef eosio::multi_index< "stat"_n, currency_stats > stats;
 
+#ifdef CORE_SYMBOL_NAME
+         static constexpr symbol core_symbol{ CORE_SYMBOL_NAME, CORE_SYMBOL_PRECISION };
+#endif
+
+         void do_issue( name to, const asset& quantity, std::string_view memo );
+         void do_retire( const asset& quantity, std::string_view memo );
+         void do_transfer( name from, name to, const asset& quantity, std::string_view memo );
+
+         symbol get_supply_symbol( symbol_code sym_code )const;
          void sub_balance( name owner, asset value );
          void add_balance( name owner, asset value, name ram_payer );
    };
@@ -5,6 +5,8 @@
 
 #include <eonio.token/eonio.token.hpp>
 
+#include <algorithm>
+
 namespace eosio {
 
 void token::create( name   issuer,
@@ -16,6 +18,9 @@ void token::create( name   issuer,
     check( sym.is_valid(), "invalid symbol name" );
     check( maximum_supply.is_valid(), "invalid supply");
     check( maximum_supply.amount > 0, "max-supply must be positive");
+#ifdef CORE_SYMBOL_NAME
+    check( sym.code() != core_symbol.code() || sym == core_symbol, "core symbol precision mismatch" );
+#endif
 
     stats statstable( _self, sym.code().raw() );
     auto existing = statstable.find( sym.code().raw() );
@@ -30,6 +35,11 @@ void token::create( name   issuer,
 
 
 void token::issue( name to, asset quantity, string memo )
+{
+    do_issue( to, quantity, memo );
+}
+
+void token::do_issue( name to, const asset& quantity, std::string_view memo )
 {
     auto sym = quantity.symbol;
     check( sym.is_valid(), "invalid symbol name" );
@@ -51,16 +61,29 @@ void token::issue( name to, asset quantity, string memo )
        s.supply += quantity;
     });
 
+#if ISSUE_VIA_INLINE_TRANSFER
     add_balance( st.issuer, quantity, st.issuer );
 
     if( to != st.issuer ) {
       SEND_INLINE_ACTION( *this, transfer, { {st.issuer, "active"_n} },
-                          { st.issuer, to, quantity, memo }
+                          { st.issuer, to, quantity, string(memo) }
       );
     }
+#else
+    if( to != st.issuer ) {
+       check( is_account( to ), "to account does not exist");
+       require_recipient( to );
+    }
+    add_balance( to, quantity, st.issuer );
+#endif
 }
 
 void token::retire( asset quantity, string memo )
+{
+    do_retire( quantity, memo );
+}
+
+void token::do_retire( const asset& quantity, std::string_view memo )
 {
     auto sym = quantity.symbol;
     check( sym.is_valid(), "invalid symbol name" );
@@ -88,20 +111,26 @@ void token::transfer( name    from,
                       name    to,
                       asset   quantity,
                       string  memo )
+{
+    do_transfer( from, to, quantity, memo );
+}
+
+void token::do_transfer( name              from,
+                         name              to,
+                         const asset&      quantity,
+                         std::string_view  memo )
 {
     check( from != to, "cannot transfer to self" );
     require_auth( from );
     check( is_account( to ), "to account does not exist");
-    auto sym = quantity.symbol.code();
-    stats statstable( _self, sym.raw() );
-    const auto& st = statstable.get( sym.raw() );
+    const auto supply_symbol = get_supply_symbol( quantity.symbol.code() );
 
     require_recipient( from );
     require_recipient( to );
 
     check( quantity.is_valid(), "invalid quantity" );
     check( quantity.amount > 0, "must transfer positive quantity" );
-    check( quantity.symbol == st.supply.symbol, "symbol precision mismatch" );
+    check( quantity.symbol == supply_symbol, "symbol precision mismatch" );
     check( memo.size() <= 256, "memo has more than 256 bytes" );
 
     auto payer = has_auth( to ) ? to : from;
@@ -110,6 +139,59 @@ void token::transfer( name    from,
     add_balance( to, quantity, payer );
 }
 
+/**
+ *  Transfers to several recipients in one action. Each symbol's stats are read once and the
+ *  sender is debited once per symbol with the sum of its transfers before the recipients are credited.
+ */
+void token::transfern( name                                      from,
+                       const std::vector<std::pair<name,asset>>& transfers,
+                       string                                    memo )
+{
+    require_auth( from );
+    check( !transfers.empty(), "no transfers" );
+    check( memo.size() <= 256, "memo has more than 256 bytes" );
+
+    std::vector<asset> totals;
+    for( const auto& t : transfers ) {
+       const auto& to       = t.first;
+       const auto& quantity = t.second;
+       check( from != to, "cannot transfer to self" );
+       check( is_account( to ), "to account does not exist");
+       check( quantity.is_valid(), "invalid quantity" );
+       check( quantity.amount > 0, "must transfer positive quantity" );
+
+       auto total = std::find_if( totals.begin(), totals.end(), [&]( const asset& a ) {
+          return a.symbol.code() == quantity.symbol.code();
+       });
+       if( total == totals.end() ) {
+          check( quantity.symbol == get_supply_symbol( quantity.symbol.code() ), "symbol precision mismatch" );
+          totals.push_back( quantity );
+       } else {
+          check( quantity.symbol == total->symbol, "symbol precision mismatch" );
+          *total += quantity;
+       }
+    }
+
+    require_recipient( from );
+    for( const auto& total : totals ) {
+       sub_balance( from, total );
+    }
+
+    for( const auto& t : transfers ) {
+       require_recipient( t.first );
+       add_balance( t.first, t.second, has_auth( t.first ) ? t.first : from );
+    }
+}
+
+symbol token::get_supply_symbol( symbol_code sym_code )const {
+#ifdef CORE_SYMBOL_NAME
+   if( sym_code == core_symbol.code() )
+      return core_symbol;
+#endif
+   stats statstable( _self, sym_code.raw() );
+   return statstable.get( sym_code.raw() ).supply.symbol;
+}
+
 void token::sub_balance( name owner, asset value ) {
    accounts from_acnts( _self, owner.value );
 
@@ -165,6 +247,58 @@ void token::close( name owner, const symbol& symbol )
    acnts.erase( it );
 }
 
+/// largest valid transfer: two names, an asset and a 256 byte memo with its varuint length
+static constexpr uint32_t max_memo_action_size = 8 + 8 + 16 + 2 + 256;
+
+void token::dispatch_memo_action( name receiver, name code, name action )
+{
+    char buffer[max_memo_action_size];
+    const auto size = action_data_size();
+    check( size <= sizeof(buffer), "memo has more than 256 bytes" );
+    read_action_data( buffer, size );
+
+    datastream<const char*> ds( buffer, size );
+    token thiscontract( receiver, code, ds );
+
+    name  from;
+    name  to;
+    asset quantity;
+    if( action == "transfer"_n ) {
+       ds >> from >> to >> quantity;
+    } else if( action == "issue"_n ) {
+       ds >> to >> quantity;
+    } else {
+       ds >> quantity;
+    }
+
+    unsigned_int memo_size;
+    ds >> memo_size;
+    check( memo_size.value <= ds.remaining(), "datastream attempted to read past the end" );
+    const std::string_view memo( ds.pos(), memo_size.value );
+
+    if( action == "transfer"_n ) {
+       thiscontract.do_transfer( from, to, quantity, memo );
+    } else if( action == "issue"_n ) {
+       thiscontract.do_issue( to, quantity, memo );
+    } else {
+       thiscontract.do_retire( quantity, memo );
+    }
+}
+
 } /// namespace eosio
 
-EOSIO_DISPATCH( eosio::token, (create)(issue)(transfer)(open)(close)(retire) )
+extern "C" {
+   [[eosio::wasm_entry]]
+   void apply( uint64_t receiver, uint64_t code, uint64_t action ) {
+      if( code == receiver ) {
+         switch( action ) {
+            case "transfer"_n.value:
+            case "issue"_n.value:
+            case "retire"_n.value:
+               eosio::token::dispatch_memo_action( eosio::name(receiver), eosio::name(code), eosio::name(action) );
+               break;
+            EOSIO_DISPATCH_HELPER( eosio::token, (create)(transfern)(open)(close) )
+         }
+      }
+   }
+}
@@ -221,6 +221,107 @@ BOOST_FIXTURE_TEST_CASE( propose_approve_execute, eosio_msig_tester ) try {
 } FC_LOG_AND_RETHROW()
 
 
+BOOST_FIXTURE_TEST_CASE( propose_approve_execute_inline, eosio_msig_tester ) try {
+   auto trx = reqauth("alice", {permission_level{N(alice), config::active_name}}, abi_serializer_max_time );
+
+   push_action( N(alice), N(propose), mvo()
+                  ("proposer",      "alice")
+                  ("proposal_name", "first")
+                  ("trx",           trx)
+                  ("requested", vector<permission_level>{{ N(alice), config::active_name }})
+   );
+
+   push_action( N(alice), N(approve), mvo()
+                  ("proposer",      "alice")
+                  ("proposal_name", "first")
+                  ("level",         permission_level{ N(alice), config::active_name })
+   );
+
+   bool scheduled = false;
+   control->applied_transaction.connect([&]( const transaction_trace_ptr& t) { if (t->scheduled) { scheduled = true; } } );
+   auto trace = push_action( N(alice), N(exec), mvo()
+                               ("proposer",      "alice")
+                               ("proposal_name", "first")
+                               ("executer",      "alice")
+                               ("exec_inline",   true)
+   );
+
+   // the proposed action runs inline in the exec transaction
+   BOOST_REQUIRE( !scheduled );
+   BOOST_REQUIRE_EQUAL( transaction_receipt::executed, trace->receipt->status );
+   BOOST_REQUIRE_EQUAL( 1, trace->action_traces.size() );
+   BOOST_REQUIRE_EQUAL( 1, trace->action_traces[0].inline_traces.size() );
+   BOOST_REQUIRE_EQUAL( name(N(reqauth)), trace->action_traces[0].inline_traces[0].act.name );
+
+   BOOST_REQUIRE_EXCEPTION( push_action( N(alice), N(exec), mvo()
+                                          ("proposer",      "alice")
+                                          ("proposal_name", "first")
+                                          ("executer",      "alice")
+                                          ("exec_inline",   true)
+                            ),
+                            eosio_assert_message_exception,
+                            eosio_assert_message_is("proposal not found")
+   );
+} FC_LOG_AND_RETHROW()
+
+
+BOOST_FIXTURE_TEST_CASE( execute_inline_restrictions, eosio_msig_tester ) try {
+   auto delayed = reqauth("alice", {permission_level{N(alice), config::active_name}}, abi_serializer_max_time );
+   delayed.delay_sec = 10;
+   auto with_cfa = reqauth("alice", {permission_level{N(alice), config::active_name}}, abi_serializer_max_time );
+   with_cfa.context_free_actions.emplace_back( vector<permission_level>{}, N(eonio.null), N(nonce), bytes{} );
+
+   for ( const auto& p : vector<std::pair<name, transaction>>{ { N(delayed), delayed }, { N(withcfa), with_cfa } } ) {
+      push_action( N(alice), N(propose), mvo()
+                     ("proposer",      "alice")
+                     ("proposal_name", p.first)
+                     ("trx",           p.second)
+                     ("requested", vector<permission_level>{{ N(alice), config::active_name }})
+      );
+      push_action( N(alice), N(approve), mvo()
+                     ("proposer",      "alice")
+                     ("proposal_name", p.first)
+                     ("level",         permission_level{ N(alice), config::active_name })
+      );
+   }
+
+   BOOST_REQUIRE_EXCEPTION( push_action( N(alice), N(exec), mvo()
+                                          ("proposer",      "alice")
+                                          ("proposal_name", "delayed")
+                                          ("executer",      "alice")
+                                          ("exec_inline",   true)
+                            ),
+                            eosio_assert_message_exception,
+                            eosio_assert_message_is("transaction with a delay cannot be executed inline")
+   );
+
+   BOOST_REQUIRE_EXCEPTION( push_action( N(alice), N(exec), mvo()
+                                          ("proposer",      "alice")
+                                          ("proposal_name", "withcfa")
+                                          ("executer",      "alice")
+                                          ("exec_inline",   true)
+                            ),
+                            eosio_assert_message_exception,
+                            eosio_assert_message_is("transaction with context-free actions cannot be executed inline")
+   );
+
+   //the delayed proposal can still be executed as a deferred transaction
+   push_action( N(alice), N(exec), mvo()
+                  ("proposer",      "alice")
+                  ("proposal_name", "delayed")
+                  ("executer",      "alice")
+   );
+   BOOST_REQUIRE_EXCEPTION( push_action( N(alice), N(exec), mvo()
+                                          ("proposer",      "alice")
+                                          ("proposal_name", "delayed")
+                                          ("executer",      "alice")
+                            ),
+                            eosio_assert_message_exception,
+                            eosio_assert_message_is("proposal not found")
+   );
+} FC_LOG_AND_RETHROW()
+
+
 BOOST_FIXTURE_TEST_CASE( propose_approve_unapprove, eosio_msig_tester ) try {
    auto trx = reqauth("alice", {permission_level{N(alice), config::active_name}}, abi_serializer_max_time );
 
@@ -255,6 +356,124 @@ BOOST_FIXTURE_TEST_CASE( propose_approve_unapprove, eosio_msig_tester ) try {
 } FC_LOG_AND_RETHROW()
 
 
+BOOST_FIXTURE_TEST_CASE( propose_approve_many_levels, eosio_msig_tester ) try {
+   auto trx = reqauth("alice", vector<permission_level>{ { N(alice), config::active_name }, { N(bob), config::active_name } }, abi_serializer_max_time );
+
+   // more requested levels than fit in one approvals row
+   vector<permission_level> requested{ { N(alice), config::active_name }, { N(bob), config::active_name } };
+   vector<account_name> approvers;
+   for ( char c = 'a'; c <= 'o'; ++c ) {
+      approvers.push_back( account_name( string("approver") + c ) );
+      requested.push_back( { approvers.back(), config::active_name } );
+   }
+   create_accounts( approvers );
+   produce_block();
+
+   // one row per level, so a level can not be requested twice
+   auto duplicated = requested;
+   duplicated.push_back( { N(bob), config::active_name } );
+   BOOST_REQUIRE_EXCEPTION( push_action( N(alice), N(propose), mvo()
+                                          ("proposer",      "alice")
+                                          ("proposal_name", "first")
+                                          ("trx",           trx)
+                                          ("requested",     duplicated)
+                            ),
+                            eosio_assert_message_exception,
+                            eosio_assert_message_is("requested approvals must be unique")
+   );
+
+   push_action( N(alice), N(propose), mvo()
+                  ("proposer",      "alice")
+                  ("proposal_name", "first")
+                  ("trx",           trx)
+                  ("requested",     requested)
+   );
+
+   push_action( N(alice), N(approve), mvo()
+                  ("proposer",      "alice")
+                  ("proposal_name", "first")
+                  ("level",         permission_level{ N(alice), config::active_name })
+   );
+
+   BOOST_REQUIRE_EXCEPTION( push_action( N(alice), N(approve), mvo()
+                                          ("proposer",      "alice")
+                                          ("proposal_name", "first")
+                                          ("level",         permission_level{ N(alice), config::active_name })
+                            ),
+                            eosio_assert_message_exception,
+                            eosio_assert_message_is("approval is not on the list of requested approvals")
+   );
+
+   BOOST_REQUIRE_EXCEPTION( push_action( N(carol), N(approve), mvo()
+                                          ("proposer",      "alice")
+                                          ("proposal_name", "first")
+                                          ("level",         permission_level{ N(carol), config::active_name })
+                            ),
+                            eosio_assert_message_exception,
+                            eosio_assert_message_is("approval is not on the list of requested approvals")
+   );
+
+   BOOST_REQUIRE_EXCEPTION( push_action( N(bob), N(unapprove), mvo()
+                                          ("proposer",      "alice")
+                                          ("proposal_name", "first")
+                                          ("level",         permission_level{ N(bob), config::active_name })
+                            ),
+                            eosio_assert_message_exception,
+                            eosio_assert_message_is("no approval previously granted")
+   );
+
+   push_action( N(bob), N(approve), mvo()
+                  ("proposer",      "alice")
+                  ("proposal_name", "first")
+                  ("level",         permission_level{ N(bob), config::active_name })
+   );
+
+   push_action( N(bob), N(unapprove), mvo()
+                  ("proposer",      "alice")
+                  ("proposal_name", "first")
+                  ("level",         permission_level{ N(bob), config::active_name })
+   );
+
+   //fail to execute without bob's approval
+   BOOST_REQUIRE_EXCEPTION( push_action( N(alice), N(exec), mvo()
+                                          ("proposer",      "alice")
+                                          ("proposal_name", "first")
+                                          ("executer",      "alice")
+                            ),
+                            eosio_assert_message_exception,
+                            eosio_assert_message_is("transaction authorization failed")
+   );
+
+   push_action( N(bob), N(approve), mvo()
+                  ("proposer",      "alice")
+                  ("proposal_name", "first")
+                  ("level",         permission_level{ N(bob), config::active_name })
+   );
+
+   transaction_trace_ptr trace;
+   control->applied_transaction.connect([&]( const transaction_trace_ptr& t) { if (t->scheduled) { trace = t; } } );
+   push_action( N(alice), N(exec), mvo()
+                  ("proposer",      "alice")
+                  ("proposal_name", "first")
+                  ("executer",      "alice")
+   );
+
+   BOOST_REQUIRE( bool(trace) );
+   BOOST_REQUIRE_EQUAL( 1, trace->action_traces.size() );
+   BOOST_REQUIRE_EQUAL( transaction_receipt::executed, trace->receipt->status );
+
+   //the approvals are removed with the proposal
+   BOOST_REQUIRE_EXCEPTION( push_action( N(alice), N(approve), mvo()
+                                          ("proposer",      "alice")
+                                          ("proposal_name", "first")
+                                          ("level",         permission_level{ N(alice), config::active_name })
+                            ),
+                            eosio_assert_message_exception,
+                            eosio_assert_message_is("proposal not found")
+   );
+} FC_LOG_AND_RETHROW()
+
+
 BOOST_FIXTURE_TEST_CASE( propose_approve_by_two, eosio_msig_tester ) try {
    auto trx = reqauth("alice", vector<permission_level>{ { N(alice), config::active_name }, { N(bob), config::active_name } }, abi_serializer_max_time );
    push_action( N(alice), N(propose), mvo()
@@ -861,6 +1080,121 @@ BOOST_FIXTURE_TEST_CASE( approve_by_two_old, eosio_msig_tester ) try {
 
 } FC_LOG_AND_RETHROW()
 
+BOOST_FIXTURE_TEST_CASE( nolegacy_rejects_old_proposals, eosio_msig_tester ) try {
+   set_code( N(eonio.msig), contracts::util::msig_wasm_old() );
+   set_abi( N(eonio.msig), contracts::util::msig_abi_old().data() );
+   produce_blocks();
+
+   auto trx = reqauth("alice", vector<permission_level>{ { N(alice), config::active_name } }, abi_serializer_max_time );
+   push_action( N(alice), N(propose), mvo()
+                  ("proposer",      "alice")
+                  ("proposal_name", "first")
+                  ("trx",           trx)
+                  ("requested", vector<permission_level>{ { N(alice), config::active_name } })
+   );
+
+   //the build without the legacy fallback does not see the approvals of old proposals
+   set_code( N(eonio.msig), contracts::msig_nolegacy_wasm() );
+   set_abi( N(eonio.msig), contracts::msig_abi().data() );
+   produce_blocks();
+
+   BOOST_REQUIRE_EXCEPTION( push_action( N(alice), N(approve), mvo()
+                                          ("proposer",      "alice")
+                                          ("proposal_name", "first")
+                                          ("level",         permission_level{ N(alice), config::active_name })
+                            ),
+                            eosio_assert_message_exception,
+                            eosio_assert_message_is("proposal not found")
+   );
+   BOOST_REQUIRE_EXCEPTION( push_action( N(alice), N(exec), mvo()
+                                          ("proposer",      "alice")
+                                          ("proposal_name", "first")
+                                          ("executer",      "alice")
+                            ),
+                            eosio_assert_message_exception,
+                            eosio_assert_message_is("proposal not found")
+   );
+
+} FC_LOG_AND_RETHROW()
+
+BOOST_FIXTURE_TEST_CASE( migrate_old_approvals, eosio_msig_tester ) try {
+   set_code( N(eonio.msig), contracts::util::msig_wasm_old() );
+   set_abi( N(eonio.msig), contracts::util::msig_abi_old().data() );
+   produce_blocks();
+
+   auto trx = reqauth("alice", vector<permission_level>{ { N(alice), config::active_name }, { N(bob), config::active_name } }, abi_serializer_max_time );
+   for ( auto proposal_name : { N(first), N(second) } ) {
+      push_action( N(alice), N(propose), mvo()
+                     ("proposer",      "alice")
+                     ("proposal_name", proposal_name)
+                     ("trx",           trx)
+                     ("requested", vector<permission_level>{ { N(alice), config::active_name }, { N(bob), config::active_name } })
+      );
+   }
+
+   //approve by alice with old version
+   push_action( N(alice), N(approve), mvo()
+                  ("proposer",      "alice")
+                  ("proposal_name", "first")
+                  ("level",         permission_level{ N(alice), config::active_name })
+   );
+
+   set_code( N(eonio.msig), contracts::msig_wasm() );
+   set_abi( N(eonio.msig), contracts::msig_abi().data() );
+   produce_blocks();
+
+   BOOST_REQUIRE_EXCEPTION( push_action( N(bob), N(migrateapps), mvo()
+                                          ("proposer", "alice")
+                                          ("max",      1)
+                            ),
+                            missing_auth_exception,
+                            fc_exception_message_starts_with("missing authority")
+   );
+
+   push_action( N(alice), N(migrateapps), mvo()
+                  ("proposer", "alice")
+                  ("max",      1)
+   );
+   BOOST_REQUIRE( !get_row_by_account( N(eonio.msig), N(alice), N(approvals2), N(first) ).empty() );
+   BOOST_REQUIRE( !get_row_by_account( N(eonio.msig), N(alice), N(approvals), N(second) ).empty() );
+   BOOST_REQUIRE( get_row_by_account( N(eonio.msig), N(eonio.msig), N(appsmigrated), N(alice) ).empty() );
+
+   push_action( N(alice), N(migrateapps), mvo()
+                  ("proposer", "alice")
+                  ("max",      10)
+   );
+   BOOST_REQUIRE( get_row_by_account( N(eonio.msig), N(alice), N(approvals), N(first) ).empty() );
+   BOOST_REQUIRE( get_row_by_account( N(eonio.msig), N(alice), N(approvals), N(second) ).empty() );
+   BOOST_REQUIRE( !get_row_by_account( N(eonio.msig), N(eonio.msig), N(appsmigrated), N(alice) ).empty() );
+
+   //a proposer without legacy approvals is not recorded
+   push_action( N(bob), N(migrateapps), mvo()
+                  ("proposer", "bob")
+                  ("max",      10)
+   );
+   BOOST_REQUIRE( get_row_by_account( N(eonio.msig), N(eonio.msig), N(appsmigrated), N(bob) ).empty() );
+
+   //alice's approval survives the migration
+   push_action( N(bob), N(approve), mvo()
+                  ("proposer",      "alice")
+                  ("proposal_name", "first")
+                  ("level",         permission_level{ N(bob), config::active_name })
+   );
+
+   transaction_trace_ptr trace;
+   control->applied_transaction.connect([&]( const transaction_trace_ptr& t) { if (t->scheduled) { trace = t; } } );
+   push_action( N(alice), N(exec), mvo()
+                  ("proposer",      "alice")
+                  ("proposal_name", "first")
+                  ("executer",      "alice")
+   );
+
+   BOOST_REQUIRE( bool(trace) );
+   BOOST_REQUIRE_EQUAL( 1, trace->action_traces.size() );
+   BOOST_REQUIRE_EQUAL( transaction_receipt::executed, trace->receipt->status );
+
+} FC_LOG_AND_RETHROW()
+
 BOOST_FIXTURE_TEST_CASE( approve_with_hash, eosio_msig_tester ) try {
    auto trx = reqauth("alice", {permission_level{N(alice), config::active_name}}, abi_serializer_max_time );
    auto trx_hash = fc::sha256::hash( trx );
@@ -880,8 +1214,8 @@ BOOST_FIXTURE_TEST_CASE( approve_with_hash, eosio_msig_tester ) try {
                                           ("level",         permission_level{ N(alice), config::active_name })
                                           ("proposal_hash", not_trx_hash)
                             ),
-                            eosio::chain::crypto_api_exception,
-                            fc_exception_message_is("hash mismatch")
+                            eosio_assert_message_exception,
+                            eosio_assert_message_is("hash mismatch")
    );
 
    //approve and execute
@@ -905,6 +1239,71 @@ BOOST_FIXTURE_TEST_CASE( approve_with_hash, eosio_msig_tester ) try {
    BOOST_REQUIRE_EQUAL( transaction_receipt::executed, trace->receipt->status );
 } FC_LOG_AND_RETHROW()
 
+BOOST_FIXTURE_TEST_CASE( approve_many_proposals, eosio_msig_tester ) try {
+   auto trx1 = reqauth("alice", {permission_level{N(alice), config::active_name}}, abi_serializer_max_time );
+   auto trx2 = reqauth("alice", vector<permission_level>{ { N(alice), config::active_name }, { N(alice), config::owner_name } }, abi_serializer_max_time );
+
+   push_action( N(alice), N(propose), mvo()
+                  ("proposer",      "alice")
+                  ("proposal_name", "first")
+                  ("trx",           trx1)
+                  ("requested", vector<permission_level>{{ N(alice), config::active_name }})
+   );
+   push_action( N(bob), N(propose), mvo()
+                  ("proposer",      "bob")
+                  ("proposal_name", "second")
+                  ("trx",           trx2)
+                  ("requested", vector<permission_level>{ { N(alice), config::active_name }, { N(alice), config::owner_name } })
+   );
+   auto proposals = fc::variants{ mvo()("first", "alice")("second", "first"),
+                                  mvo()("first", "bob")("second", "second") };
+
+   //fail with a hash of another proposal
+   BOOST_REQUIRE_EXCEPTION( push_action( N(alice), N(approven), mvo()
+                                          ("level",           permission_level{ N(alice), config::active_name })
+                                          ("proposals",       proposals)
+                                          ("proposal_hashes", vector<fc::sha256>{ fc::sha256::hash( trx1 ), fc::sha256::hash( trx1 ) })
+                            ),
+                            eosio_assert_message_exception,
+                            eosio_assert_message_is("hash mismatch")
+   );
+
+   push_action( N(alice), N(approven), mvo()
+                  ("level",           permission_level{ N(alice), config::active_name })
+                  ("proposals",       proposals)
+                  ("proposal_hashes", vector<fc::sha256>{ fc::sha256::hash( trx1 ), fc::sha256::hash( trx2 ) })
+   );
+
+   //the first proposal only needs alice@active
+   transaction_trace_ptr trace;
+   control->applied_transaction.connect([&]( const transaction_trace_ptr& t) { if (t->scheduled) { trace = t; } } );
+   push_action( N(alice), N(exec), mvo()
+                  ("proposer",      "alice")
+                  ("proposal_name", "first")
+                  ("executer",      "alice")
+   );
+   BOOST_REQUIRE( bool(trace) );
+   BOOST_REQUIRE_EQUAL( transaction_receipt::executed, trace->receipt->status );
+
+   //the second proposal still needs alice@owner
+   BOOST_REQUIRE_EXCEPTION( push_action( N(bob), N(exec), mvo()
+                                          ("proposer",      "bob")
+                                          ("proposal_name", "second")
+                                          ("executer",      "bob")
+                            ),
+                            eosio_assert_message_exception,
+                            eosio_assert_message_is("transaction authorization failed")
+   );
+
+   BOOST_REQUIRE_EXCEPTION( push_action( N(alice), N(approven), mvo()
+                                          ("level",     permission_level{ N(alice), config::active_name })
+                                          ("proposals", fc::variants{ mvo()("first", "bob")("second", "second") })
+                            ),
+                            eosio_assert_message_exception,
+                            eosio_assert_message_is("approval is not on the list of requested approvals")
+   );
+} FC_LOG_AND_RETHROW()
+
 BOOST_FIXTURE_TEST_CASE( switch_proposal_and_fail_approve_with_hash, eosio_msig_tester ) try {
    auto trx1 = reqauth("alice", {permission_level{N(alice), config::active_name}}, abi_serializer_max_time );
    auto trx1_hash = fc::sha256::hash( trx1 );
@@ -942,9 +1341,60 @@ BOOST_FIXTURE_TEST_CASE( switch_proposal_and_fail_approve_with_hash, eosio_msig_
                                           ("level",         permission_level{ N(alice), config::active_name })
                                           ("proposal_hash", trx1_hash)
                             ),
+                            eosio_assert_message_exception,
+                            eosio_assert_message_is("hash mismatch")
+   );
+} FC_LOG_AND_RETHROW()
+
+BOOST_FIXTURE_TEST_CASE( approve_with_hash_old, eosio_msig_tester ) try {
+   set_code( N(eonio.msig), contracts::util::msig_wasm_old() );
+   set_abi( N(eonio.msig), contracts::util::msig_abi_old().data() );
+   produce_blocks();
+
+   //propose with old version of eonio.msig, the proposal has no trx_hash
+   auto trx = reqauth("alice", {permission_level{N(alice), config::active_name}}, abi_serializer_max_time );
+   auto trx_hash = fc::sha256::hash( trx );
+   auto not_trx_hash = fc::sha256::hash( trx_hash );
+   push_action( N(alice), N(propose), mvo()
+                  ("proposer",      "alice")
+                  ("proposal_name", "first")
+                  ("trx",           trx)
+                  ("requested", vector<permission_level>{{ N(alice), config::active_name }})
+   );
+
+   set_code( N(eonio.msig), contracts::msig_wasm() );
+   set_abi( N(eonio.msig), contracts::msig_abi().data() );
+   produce_blocks();
+
+   //the hash is computed from the packed transaction
+   BOOST_REQUIRE_EXCEPTION( push_action( N(alice), N(approve), mvo()
+                                          ("proposer",      "alice")
+                                          ("proposal_name", "first")
+                                          ("level",         permission_level{ N(alice), config::active_name })
+                                          ("proposal_hash", not_trx_hash)
+                            ),
                             eosio::chain::crypto_api_exception,
                             fc_exception_message_is("hash mismatch")
    );
+
+   push_action( N(alice), N(approve), mvo()
+                  ("proposer",      "alice")
+                  ("proposal_name", "first")
+                  ("level",         permission_level{ N(alice), config::active_name })
+                  ("proposal_hash", trx_hash)
+   );
+
+   transaction_trace_ptr trace;
+   control->applied_transaction.connect([&]( const transaction_trace_ptr& t) { if (t->scheduled) { trace = t; } } );
+   push_action( N(alice), N(exec), mvo()
+                  ("proposer",      "alice")
+                  ("proposal_name", "first")
+                  ("executer",      "alice")
+   );
+
+   BOOST_REQUIRE( bool(trace) );
+   BOOST_REQUIRE_EQUAL( 1, trace->action_traces.size() );
+   BOOST_REQUIRE_EQUAL( transaction_receipt::executed, trace->receipt->status );
 } FC_LOG_AND_RETHROW()
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -37,7 +37,8 @@ public:
       produce_blocks( 2 );
 
       create_accounts({ N(eonio.token), N(eonio.ram), N(eonio.ramfee), N(eonio.stake),
-               N(eonio.bpay), N(eonio.vpay), N(eonio.saving), N(eonio.names), N(eonio.rex) });
+               N(eonio.bpay), N(eonio.vpay), N(eonio.saving), N(eonio.names), N(eonio.rex),
+               N(eonio.bpstk), N(eonio.prop) });
 
 
       produce_blocks( 100 );
@@ -341,6 +342,10 @@ public:
       );
    }
 
+   action_result reconcile( const account_name& actor = config::system_account_name ) {
+      return push_action( name(actor), N(reconcile), mvo() );
+   }
+
    action_result buyrex( const account_name& from, const asset& amount ) {
       return push_action( name(from), N(buyrex), mvo()
                           ("from",   from)
@@ -676,6 +681,20 @@ public:
       }
    }
 
+   /**
+    * Makes gnodes governance nodes and stakes enough for voter to pass proposals on its own.
+    */
+   void setup_proposal_accounts( const std::vector<account_name>& gnodes, const account_name& voter ) {
+      for (const auto& a: gnodes) {
+         create_account_with_resources( a, config::system_account_name, core_sym::from_string("10.0000"), false );
+         transfer( config::system_account_name, a, core_sym::from_string("100.0000"), config::system_account_name );
+         BOOST_REQUIRE_EQUAL( success(), staketognode( a ) );
+      }
+      create_account_with_resources( voter, config::system_account_name, core_sym::from_string("10.0000"), false );
+      transfer( config::system_account_name, voter, core_sym::from_string("200000.0000"), config::system_account_name );
+      BOOST_REQUIRE_EQUAL( success(), stake( voter, voter, core_sym::from_string("100000.0000"), core_sym::from_string("100000.0000") ) );
+   }
+
    action_result bidname( const account_name& bidder, const account_name& newname, const asset& bid ) {
       return push_action( name(bidder), N(bidname), mvo()
                           ("bidder",  bidder)
@@ -684,6 +703,19 @@ public:
                           );
    }
 
+   action_result bidrefund( const account_name& bidder, const account_name& newname ) {
+      return push_action( name(bidder), N(bidrefund), mvo()
+                          ("bidder",  bidder)
+                          ("newname", newname)
+                          );
+   }
+
+   action_result sweepbids( const account_name& signer, uint16_t max ) {
+      return push_action( name(signer), N(sweepbids), mvo()
+                          ("max", max)
+                          );
+   }
+
    static fc::variant_object producer_parameters_example( int n ) {
       return mutable_variant_object()
          ("max_block_net_usage", 10000000 + n )
@@ -725,6 +757,62 @@ public:
                          ("producers", producers));
    }
 
+   action_result staketognode( const account_name& owner ) {
+      return push_action( owner, N(staketognode), mvo()
+                          ("owner",        owner)
+                          ("producer_key", get_public_key( owner, "active" ) )
+                          ("url",          "" )
+                          ("location",     0 )
+      );
+   }
+
+   action_result newproposal( const account_name& owner, const account_name& account, int16_t type ) {
+      return push_action( owner, N(newproposal), mvo()
+                          ("owner",        owner)
+                          ("account",      account)
+                          ("block_height", 0)
+                          ("type",         type)
+                          ("status",       0)
+      );
+   }
+
+   action_result voteproposal( const account_name& voter, uint64_t proposal_id, bool yea ) {
+      return push_action( voter, N(voteproposal), mvo()
+                          ("voter_name",  voter)
+                          ("proposal_id", proposal_id)
+                          ("yea",         yea)
+      );
+   }
+
+   action_result execproposal( const account_name& owner, uint64_t proposal_id ) {
+      return push_action( owner, N(execproposal), mvo()
+                          ("owner",       owner)
+                          ("proposal_id", proposal_id)
+      );
+   }
+
+   action_result execprops( const account_name& owner, uint16_t max ) {
+      return push_action( owner, N(execprops), mvo()
+                          ("owner", owner)
+                          ("max",   max)
+      );
+   }
+
+   fc::variant get_proposal( uint64_t proposal_id ) {
+      vector<char> data = get_row_by_account( config::system_account_name, config::system_account_name, N(proposals), proposal_id );
+      return data.empty() ? fc::variant() : abi_ser.binary_to_variant( "proposal_info", data, abi_serializer_max_time );
+   }
+
+   fc::variant get_proposal_vote( uint64_t proposal_id, const account_name& voter ) {
+      vector<char> data = get_row_by_account( config::system_account_name, proposal_id, N(propvotes), voter );
+      return data.empty() ? fc::variant() : abi_ser.binary_to_variant( "proposal_vote", data, abi_serializer_max_time );
+   }
+
+   fc::variant get_gnode( const account_name& owner ) {
+      vector<char> data = get_row_by_account( config::system_account_name, config::system_account_name, N(gnode), owner );
+      return data.empty() ? fc::variant() : abi_ser.binary_to_variant( "goverance_node_info", data, abi_serializer_max_time );
+   }
+
    uint32_t last_block_time() const {
       return time_point_sec( control->head_block_time() ).sec_since_epoch();
    }
@@ -740,20 +828,101 @@ public:
    }
 
    fc::variant get_voter_info( const account_name& act ) {
-      vector<char> data = get_row_by_account( config::system_account_name, config::system_account_name, N(voters), act );
+      // converted voters are split between voters2 and voterprods, report them in the voter_info layout
+      vector<char> data = get_row_by_account( config::system_account_name, config::system_account_name, N(voters2), act );
+      if( !data.empty() ) {
+         mvo v = abi_ser.binary_to_variant( "voter_info2", data, abi_serializer_max_time ).get_object();
+         vector<char> prods = get_row_by_account( config::system_account_name, config::system_account_name, N(voterprods), act );
+         v["producers"] = prods.empty() ? fc::variant( variants() )
+                                        : abi_ser.binary_to_variant( "voter_producers", prods, abi_serializer_max_time )["producers"];
+         v.erase( "num_producers" );
+         return v;
+      }
+      data = get_row_by_account( config::system_account_name, config::system_account_name, N(voters), act );
       return data.empty() ? fc::variant() : abi_ser.binary_to_variant( "voter_info", data, abi_serializer_max_time );
    }
 
    fc::variant get_producer_info( const account_name& act ) {
       vector<char> data = get_row_by_account( config::system_account_name, config::system_account_name, N(producers), act );
-      return abi_ser.binary_to_variant( "producer_info", data, abi_serializer_max_time );
+      mvo prod = abi_ser.binary_to_variant( "producer_info", data, abi_serializer_max_time ).get_object();
+      // frequently updated fields are kept in producers3 once a producer is migrated
+      const auto prod3 = get_producer_info3( act );
+      if( !prod3.is_null() ) {
+         for( const auto& field : { "total_votes", "is_active", "unpaid_blocks", "last_claim_time" } ) {
+            prod[field] = prod3[field];
+         }
+      }
+      // onblock counts blocks by schedule position until they are folded into the producer row
+      const uint32_t counted = get_counted_unpaid_blocks( act );
+      if( counted > 0 ) {
+         prod["unpaid_blocks"] = prod["unpaid_blocks"].as<uint32_t>() + counted;
+      }
+      return prod;
+   }
+
+   fc::variant get_producer_info3( const account_name& act ) {
+      vector<char> data = get_row_by_account( config::system_account_name, config::system_account_name, N(producers3), act );
+      return data.empty() ? fc::variant() : abi_ser.binary_to_variant( "producer_info3", data, abi_serializer_max_time );
+   }
+
+   fc::variant get_vote_delta( const account_name& act ) {
+      vector<char> data = get_row_by_account( config::system_account_name, config::system_account_name, N(votedeltas), act );
+      return data.empty() ? fc::variant() : abi_ser.binary_to_variant( "producer_vote_delta", data, abi_serializer_max_time );
+   }
+
+   vector<account_name> get_schedule_positions() {
+      vector<char> data = get_row_by_account( config::system_account_name, config::system_account_name, N(schedpos), N(schedpos) );
+      return data.empty() ? vector<account_name>() : abi_ser.binary_to_variant( "schedule_positions", data, abi_serializer_max_time )["producers"].as<vector<account_name>>();
+   }
+
+   uint32_t get_counted_unpaid_blocks( const account_name& act ) {
+      vector<char> data = get_row_by_account( config::system_account_name, config::system_account_name, N(schedpos), N(schedpos) );
+      if( data.empty() ) return 0;
+      const auto producers = abi_ser.binary_to_variant( "schedule_positions", data, abi_serializer_max_time )["producers"].as<vector<account_name>>();
+      const auto counters  = get_global_state4()["schedule_unpaid_blocks"].as<vector<uint32_t>>();
+      for( size_t i = 0; i < producers.size() && i < counters.size(); ++i ) {
+         if( producers[i] == act ) return counters[i];
+      }
+      return 0;
    }
 
    fc::variant get_producer_info2( const account_name& act ) {
-      vector<char> data = get_row_by_account( config::system_account_name, config::system_account_name, N(producers2), act );
+      // fixed point rows are reported in the producer_info2 layout, votepay_share in vote seconds
+      vector<char> data = get_row_by_account( config::system_account_name, config::system_account_name, N(prodvpay), act );
+      if( !data.empty() ) {
+         mvo prod = abi_ser.binary_to_variant( "producer_votepay", data, abi_serializer_max_time ).get_object();
+         prod["votepay_share"] = uint128_to_double( prod["votepay_share"] ) / 1E6;
+         return prod;
+      }
+      data = get_row_by_account( config::system_account_name, config::system_account_name, N(producers2), act );
       return abi_ser.binary_to_variant( "producer_info2", data, abi_serializer_max_time );
    }
 
+   fc::variant get_producer_votepay( const account_name& act ) {
+      vector<char> data = get_row_by_account( config::system_account_name, config::system_account_name, N(prodvpay), act );
+      return data.empty() ? fc::variant() : abi_ser.binary_to_variant( "producer_votepay", data, abi_serializer_max_time );
+   }
+
+   static unsigned __int128 to_uint128( const fc::variant& v ) {
+      const string str = v.as_string();
+      unsigned __int128 result = 0;
+      if( str.size() > 2 && str[0] == '0' && str[1] == 'x' ) {
+         // little endian hex
+         for( size_t i = str.size(); i >= 4; i -= 2 ) {
+            result = result * 256 + std::stoi( str.substr( i - 2, 2 ), nullptr, 16 );
+         }
+      } else {
+         for( char c : str ) {
+            result = result * 10 + (c - '0');
+         }
+      }
+      return result;
+   }
+
+   static double uint128_to_double( const fc::variant& v ) {
+      return static_cast<double>( to_uint128( v ) );
+   }
+
    void create_currency( name contract, name manager, asset maxsupply ) {
       auto act =  mutable_variant_object()
          ("issuer",       manager )
@@ -810,12 +979,34 @@ public:
 
    fc::variant get_global_state2() {
       vector<char> data = get_row_by_account( config::system_account_name, config::system_account_name, N(global2), N(global2) );
-      return data.empty() ? fc::variant() : abi_ser.binary_to_variant( "eosio_global_state2", data, abi_serializer_max_time );
+      if( data.empty() ) return fc::variant();
+      mvo gs2 = abi_ser.binary_to_variant( "eosio_global_state2", data, abi_serializer_max_time ).get_object();
+      const auto gs4 = get_global_state4();
+      if( !gs4.is_null() && gs4["votepay_fixed_point"].as_bool() ) {
+         gs2["total_producer_votepay_share"] = uint128_to_double( gs4["total_votepay_share"] ) / 1E6;
+      }
+      return gs2;
    }
 
    fc::variant get_global_state3() {
       vector<char> data = get_row_by_account( config::system_account_name, config::system_account_name, N(global3), N(global3) );
-      return data.empty() ? fc::variant() : abi_ser.binary_to_variant( "eosio_global_state3", data, abi_serializer_max_time );
+      if( data.empty() ) return fc::variant();
+      mvo gs3 = abi_ser.binary_to_variant( "eosio_global_state3", data, abi_serializer_max_time ).get_object();
+      const auto gs4 = get_global_state4();
+      if( !gs4.is_null() && gs4["votepay_fixed_point"].as_bool() ) {
+         gs3["total_vpay_share_change_rate"] = uint128_to_double( gs4["vpay_share_change_rate"] );
+      }
+      return gs3;
+   }
+
+   fc::variant get_global_state4() {
+      vector<char> data = get_row_by_account( config::system_account_name, config::system_account_name, N(global4), N(global4) );
+      return data.empty() ? fc::variant() : abi_ser.binary_to_variant( "eosio_global_state4", data, abi_serializer_max_time );
+   }
+
+   fc::variant get_ledger_entry( const account_name& act ) {
+      vector<char> data = get_row_by_account( config::system_account_name, config::system_account_name, N(sysledger), act );
+      return data.empty() ? fc::variant() : abi_ser.binary_to_variant( "ledger_entry", data, abi_serializer_max_time );
    }
 
    fc::variant get_refund_request( name account ) {
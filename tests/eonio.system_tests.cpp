@@ -37,6 +37,8 @@ BOOST_FIXTURE_TEST_CASE( buysell, eosio_system_tester ) try {
    BOOST_REQUIRE_EQUAL( core_sym::from_string("800.0000"), get_balance( "alice1111111" ) );
    BOOST_REQUIRE_EQUAL( initial_ram_balance + core_sym::from_string("199.0000"), get_balance(N(eonio.ram)) );
    BOOST_REQUIRE_EQUAL( initial_ramfee_balance + core_sym::from_string("1.0000"), get_balance(N(eonio.ramfee)) );
+   // the fee is settled from eonio.ram to eonio.ramfee by the next onblock
+   BOOST_REQUIRE_EQUAL( 0, get_global_state4()["pending_ramfee"].as_int64() );
 
    total = get_total_stake( "alice1111111" );
    auto bytes = total["ram_bytes"].as_uint64();
@@ -165,6 +167,10 @@ BOOST_FIXTURE_TEST_CASE( stake_unstake, eosio_system_tester ) try {
    BOOST_REQUIRE_EQUAL( core_sym::from_string("110.0000").get_amount(), total["cpu_weight"].as<asset>().get_amount() );
 
    REQUIRE_MATCHING_OBJECT( voter( "alice1111111", core_sym::from_string("300.0000")), get_voter_info( "alice1111111" ) );
+   // new voters are stored in the compact layout only, without a producer list
+   BOOST_REQUIRE_EQUAL( true, get_row_by_account( config::system_account_name, config::system_account_name, N(voters), N(alice1111111) ).empty() );
+   BOOST_REQUIRE_EQUAL( false, get_row_by_account( config::system_account_name, config::system_account_name, N(voters2), N(alice1111111) ).empty() );
+   BOOST_REQUIRE_EQUAL( true, get_row_by_account( config::system_account_name, config::system_account_name, N(voterprods), N(alice1111111) ).empty() );
 
    auto bytes = total["ram_bytes"].as_uint64();
    BOOST_REQUIRE_EQUAL( true, 0 < bytes );
@@ -746,6 +752,11 @@ BOOST_FIXTURE_TEST_CASE( producer_register_unregister, eosio_system_tester ) try
    BOOST_REQUIRE_EQUAL( 0, info["total_votes"].as_double() );
    BOOST_REQUIRE_EQUAL( "http://block.two", info["url"].as_string() );
 
+   // producers registered on a fresh chain start out in producers3
+   BOOST_REQUIRE_EQUAL( false, get_producer_info3( "alice1111111" ).is_null() );
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg( "producers are already migrated" ),
+                        push_action( N(bob111111111), N(migrateprods), mvo()("max", 10) ) );
+
    //unregister bob111111111 who is not a producer
    BOOST_REQUIRE_EQUAL( wasm_assert_msg( "producer not found" ),
                         push_action( N(bob111111111), N(unregprod), mvo()
@@ -980,6 +991,269 @@ BOOST_FIXTURE_TEST_CASE( producer_keep_votes, eosio_system_tester, * boost::unit
 } FC_LOG_AND_RETHROW()
 
 
+BOOST_FIXTURE_TEST_CASE( deferred_producer_votes, eosio_system_tester, * boost::unit_test::tolerance(1e+5) ) try {
+   issue( "alice1111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( N(alice1111111) ) );
+
+   issue( "bob111111111", core_sym::from_string("2000.0000"),  config::system_account_name );
+   BOOST_REQUIRE_EQUAL( success(), stake( "bob111111111", core_sym::from_string("13.0000"), core_sym::from_string("0.5791") ) );
+
+   BOOST_REQUIRE_EQUAL( error("missing authority of eosio"),
+                        push_action( N(alice1111111), N(setvotedefer), mvo()("defer", true) ) );
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg("vote delta mode is unchanged"),
+                        push_action( config::system_account_name, N(setvotedefer), mvo()("defer", false) ) );
+   BOOST_REQUIRE_EQUAL( success(), push_action( config::system_account_name, N(setvotedefer), mvo()("defer", true) ) );
+
+   //the vote is queued, producer votes are unchanged until the next schedule update
+   BOOST_REQUIRE_EQUAL( success(), vote( N(bob111111111), { N(alice1111111) } ) );
+   BOOST_TEST_REQUIRE( 0 == get_producer_info( "alice1111111" )["total_votes"].as_double() );
+   BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("13.5791")) == get_vote_delta( "alice1111111" )["vote_delta"].as_double() );
+
+   //stake changes accumulate on the same row
+   BOOST_REQUIRE_EQUAL( success(), stake( "bob111111111", core_sym::from_string("10.0000"), core_sym::from_string("0.0000") ) );
+   BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("23.5791")) == get_vote_delta( "alice1111111" )["vote_delta"].as_double() );
+   BOOST_TEST_REQUIRE( 0 == get_producer_info( "alice1111111" )["total_votes"].as_double() );
+
+   //turning the mode off applies all queued changes
+   BOOST_REQUIRE_EQUAL( success(), push_action( config::system_account_name, N(setvotedefer), mvo()("defer", false) ) );
+   BOOST_REQUIRE_EQUAL( true, get_vote_delta( "alice1111111" ).is_null() );
+   BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("23.5791")) == get_producer_info( "alice1111111" )["total_votes"].as_double() );
+
+} FC_LOG_AND_RETHROW()
+
+BOOST_FIXTURE_TEST_CASE( deferred_votes_applied_by_proposals, eosio_system_tester, * boost::unit_test::tolerance(1e+5) ) try {
+   const account_name voter = N(propvoter111);
+   setup_proposal_accounts( { N(gnode1111111), N(gnode1111112) }, voter );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( N(gnode1111111) ) );
+   BOOST_REQUIRE_EQUAL( success(), push_action( config::system_account_name, N(setvotedefer), mvo()("defer", true) ) );
+
+   BOOST_REQUIRE_EQUAL( success(), vote( voter, { N(gnode1111111) } ) );
+   BOOST_REQUIRE_EQUAL( false, get_vote_delta( "gnode1111111" ).is_null() );
+   BOOST_TEST_REQUIRE( 0 == get_producer_info( "gnode1111111" )["total_votes"].as_double() );
+
+   //queued vote changes are applied before an executed proposal ranks the producers
+   BOOST_REQUIRE_EQUAL( success(), newproposal( N(gnode1111111), N(gnode1111111), 1 ) );
+   BOOST_REQUIRE_EQUAL( success(), voteproposal( voter, 0, true ) );
+   BOOST_REQUIRE_EQUAL( success(), execproposal( N(gnode1111111), 0 ) );
+   BOOST_REQUIRE_EQUAL( true, get_vote_delta( "gnode1111111" ).is_null() );
+   BOOST_TEST_REQUIRE( stake2votes( asset( get_voter_info( voter )["staked"].as<int64_t>(), symbol{CORE_SYM} ) )
+                       == get_producer_info( "gnode1111111" )["total_votes"].as_double() );
+
+   //and before execprops does
+   BOOST_REQUIRE_EQUAL( success(), stake( voter, voter, core_sym::from_string("10.0000"), core_sym::from_string("0.0000") ) );
+   BOOST_REQUIRE_EQUAL( false, get_vote_delta( "gnode1111111" ).is_null() );
+   BOOST_REQUIRE_EQUAL( success(), newproposal( N(gnode1111112), N(gnode1111112), 1 ) );
+   //a proposal which changes no producers leaves them queued
+   BOOST_REQUIRE_EQUAL( success(), execproposal( N(gnode1111112), 1 ) );
+   BOOST_REQUIRE_EQUAL( false, get_vote_delta( "gnode1111111" ).is_null() );
+   BOOST_REQUIRE_EQUAL( success(), voteproposal( voter, 1, true ) );
+   BOOST_REQUIRE_EQUAL( success(), execprops( N(gnode1111112), 10 ) );
+   BOOST_REQUIRE_EQUAL( true, get_vote_delta( "gnode1111111" ).is_null() );
+   BOOST_TEST_REQUIRE( stake2votes( asset( get_voter_info( voter )["staked"].as<int64_t>(), symbol{CORE_SYM} ) )
+                       == get_producer_info( "gnode1111111" )["total_votes"].as_double() );
+
+} FC_LOG_AND_RETHROW()
+
+BOOST_FIXTURE_TEST_CASE( execprops_tests, eosio_system_tester ) try {
+   const account_name voter = N(propvoter111);
+   const account_name a = N(gnode1111111), b = N(gnode1111112), c = N(gnode1111113), d = N(gnode1111114);
+   setup_proposal_accounts( { a, b, c, d }, voter );
+
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg("must execute at least one proposal"), execprops( a, 0 ) );
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg("only governance node can exec proposal"), execprops( voter, 1 ) );
+
+   //executed proposals do not hold back the proposals behind them
+   BOOST_REQUIRE_EQUAL( success(), newproposal( a, a, 1 ) );
+   BOOST_REQUIRE_EQUAL( success(), voteproposal( voter, 0, true ) );
+   BOOST_REQUIRE_EQUAL( success(), execprops( a, 1 ) );
+   BOOST_REQUIRE_EQUAL( true, get_proposal( 0 )["is_exec"].as_bool() );
+   BOOST_REQUIRE_EQUAL( true, get_gnode( a )["is_bp"].as_bool() );
+   BOOST_REQUIRE_EQUAL( 1, get_global_state4()["next_exec_proposal"].as_uint64() );
+
+   BOOST_REQUIRE_EQUAL( success(), newproposal( b, b, 1 ) );
+   BOOST_REQUIRE_EQUAL( success(), newproposal( c, c, 1 ) );
+   BOOST_REQUIRE_EQUAL( success(), voteproposal( voter, 1, true ) );
+   BOOST_REQUIRE_EQUAL( success(), voteproposal( voter, 2, true ) );
+   BOOST_REQUIRE_EQUAL( success(), execprops( b, 1 ) );
+   BOOST_REQUIRE_EQUAL( true,  get_proposal( 1 )["is_exec"].as_bool() );
+   BOOST_REQUIRE_EQUAL( false, get_proposal( 2 )["is_exec"].as_bool() );
+   BOOST_REQUIRE_EQUAL( success(), execprops( c, 1 ) );
+   BOOST_REQUIRE_EQUAL( true,  get_proposal( 2 )["is_exec"].as_bool() );
+   BOOST_REQUIRE_EQUAL( 3, get_global_state4()["next_exec_proposal"].as_uint64() );
+
+   //an open proposal which is not satisfied is visited again, once it ended it is settled
+   BOOST_REQUIRE_EQUAL( success(), newproposal( a, b, 2 ) );
+   BOOST_REQUIRE_EQUAL( success(), execprops( a, 1 ) );
+   BOOST_REQUIRE_EQUAL( false, get_proposal( 3 )["is_satisfy"].as_bool() );
+   BOOST_REQUIRE_EQUAL( 3, get_global_state4()["next_exec_proposal"].as_uint64() );
+   produce_block( fc::days(2) );
+   produce_blocks( 100 );
+   BOOST_REQUIRE_EQUAL( success(), execprops( a, 1 ) );
+   BOOST_REQUIRE_EQUAL( false, get_proposal( 3 )["is_satisfy"].as_bool() );
+   BOOST_REQUIRE_EQUAL( 4, get_global_state4()["next_exec_proposal"].as_uint64() );
+
+   //the changes of one call are applied in order, b is removed and added back, d is added and removed
+   BOOST_REQUIRE_EQUAL( success(), newproposal( a, b, 2 ) );
+   BOOST_REQUIRE_EQUAL( success(), newproposal( b, b, 1 ) );
+   BOOST_REQUIRE_EQUAL( success(), newproposal( d, d, 1 ) );
+   BOOST_REQUIRE_EQUAL( success(), newproposal( a, d, 2 ) );
+   BOOST_REQUIRE_EQUAL( success(), newproposal( a, c, 2 ) );
+   for( uint64_t id = 4; id <= 8; ++id ) {
+      BOOST_REQUIRE_EQUAL( success(), voteproposal( voter, id, true ) );
+   }
+   //adding a producer requires its authority
+   base_tester::push_action( config::system_account_name, N(execprops), vector<account_name>{ b, d }, mvo()
+                             ("owner", b)
+                             ("max",   10) );
+   produce_block();
+   for( uint64_t id = 4; id <= 8; ++id ) {
+      BOOST_REQUIRE_EQUAL( true, get_proposal( id )["is_exec"].as_bool() );
+   }
+   BOOST_REQUIRE_EQUAL( 9,     get_global_state4()["next_exec_proposal"].as_uint64() );
+   BOOST_REQUIRE_EQUAL( true,  get_gnode( b )["is_bp"].as_bool() );
+   BOOST_REQUIRE_EQUAL( false, get_gnode( c )["is_bp"].as_bool() );
+   BOOST_REQUIRE_EQUAL( false, get_gnode( d )["is_bp"].as_bool() );
+   BOOST_REQUIRE( (vector<account_name>{ a, b }) == get_schedule_positions() );
+
+} FC_LOG_AND_RETHROW()
+
+BOOST_FIXTURE_TEST_CASE( remove_producer_with_historical_producers, eosio_system_tester ) try {
+   const account_name voter = N(propvoter111);
+   const account_name a = N(gnode1111111), b = N(gnode1111112), c = N(gnode1111113);
+   setup_proposal_accounts( { a, b, c }, voter );
+
+   auto exec = [&]( const account_name& owner, uint64_t id ) {
+      auto trace = base_tester::push_action( config::system_account_name, N(execproposal), owner, mvo()
+                                             ("owner",       owner)
+                                             ("proposal_id", id) );
+      produce_block();
+      return trace->action_traces[0].elapsed;
+   };
+
+   for( const auto& g : { a, b, c } ) {
+      BOOST_REQUIRE_EQUAL( success(), newproposal( g, g, 1 ) );
+   }
+   for( uint64_t id = 0; id < 3; ++id ) {
+      BOOST_REQUIRE_EQUAL( success(), voteproposal( voter, id, true ) );
+   }
+   exec( a, 0 );
+   exec( b, 1 );
+   exec( c, 2 );
+   BOOST_REQUIRE_EQUAL( success(), vote( voter, { a, b, c } ) );
+
+   BOOST_REQUIRE_EQUAL( success(), newproposal( a, c, 2 ) );
+   BOOST_REQUIRE_EQUAL( success(), voteproposal( voter, 3, true ) );
+   const auto base_elapsed = exec( a, 3 );
+   BOOST_REQUIRE_EQUAL( false, get_gnode( c )["is_bp"].as_bool() );
+
+   //2000 producers which registered once and are no longer active
+   const std::string chars = "abcdefghijklmnopqrstuvwxyz12345";
+   for( size_t first = 0; first < 2000; first += 20 ) {
+      vector<account_name> batch;
+      for( size_t i = first; i < first + 20; ++i ) {
+         batch.emplace_back( "histprod" + std::string( 1, chars[i / (31 * 31)] ) + chars[i / 31 % 31] + chars[i % 31] );
+      }
+      setup_producer_accounts( batch );
+      produce_block();
+
+      signed_transaction trx;
+      for( const auto& p : batch ) {
+         trx.actions.emplace_back( get_action( config::system_account_name, N(regproducer), vector<permission_level>{ { p, config::active_name } },
+                                               mvo()
+                                               ("producer",     p)
+                                               ("producer_key", get_public_key( p, "active" ))
+                                               ("url",          "")
+                                               ("location",     0) ) );
+         trx.actions.emplace_back( get_action( config::system_account_name, N(unregprod), vector<permission_level>{ { p, config::active_name } },
+                                               mvo()("producer", p) ) );
+      }
+      set_transaction_headers( trx );
+      for( const auto& p : batch ) {
+         trx.sign( get_private_key( p, "active" ), control->get_chain_id() );
+      }
+      push_transaction( trx );
+      produce_block();
+   }
+
+   //with more than 7 producers the proposal must have ended
+   BOOST_REQUIRE_EQUAL( success(), newproposal( a, b, 2 ) );
+   BOOST_REQUIRE_EQUAL( success(), voteproposal( voter, 4, true ) );
+   produce_block( fc::days(1) );
+   produce_blocks( 2 );
+   const auto elapsed = exec( a, 4 );
+   BOOST_REQUIRE_EQUAL( false, get_gnode( b )["is_bp"].as_bool() );
+
+   //the removal only walks the active producers, the historical rows do not slow it down
+   BOOST_TEST_MESSAGE( "remove with 3 producers: " << base_elapsed.count() << " us, with 2003 producers: " << elapsed.count() << " us" );
+   BOOST_TEST( elapsed.count() < 3 * base_elapsed.count() + 500 );
+
+} FC_LOG_AND_RETHROW()
+
+BOOST_FIXTURE_TEST_CASE( proposal_vote_tallies, eosio_system_tester ) try {
+   const account_name voter = N(propvoter111), voter2 = N(propvoter112);
+   const account_name a = N(gnode1111111);
+   setup_proposal_accounts( { a }, voter );
+   create_account_with_resources( voter2, config::system_account_name, core_sym::from_string("10.0000"), false );
+   transfer( config::system_account_name, voter2, core_sym::from_string("100000.0000"), config::system_account_name );
+   BOOST_REQUIRE_EQUAL( success(), stake( voter2, voter2, core_sym::from_string("50000.0000"), core_sym::from_string("50000.0000") ) );
+   // 200000 and 100000 staked tokens are 200+20+2 and 100+10+1 proposal votes
+   const int64_t votes = 222, votes2 = 111;
+   const uint32_t yea_flag = 0x80000000;
+
+   BOOST_REQUIRE_EQUAL( success(), newproposal( a, a, 1 ) );
+   BOOST_REQUIRE_EQUAL( success(), voteproposal( voter, 0, true ) );
+   BOOST_REQUIRE_EQUAL( success(), voteproposal( voter2, 0, false ) );
+   auto prop = get_proposal( 0 );
+   BOOST_REQUIRE_EQUAL( votes,  prop["total_yeas"].as_int64() );
+   BOOST_REQUIRE_EQUAL( votes2, prop["total_nays"].as_int64() );
+   BOOST_REQUIRE_EQUAL( yea_flag, get_proposal_vote( 0, voter )["vote_info"].as<uint32_t>() & yea_flag );
+   BOOST_REQUIRE_EQUAL( 0,        get_proposal_vote( 0, voter2 )["vote_info"].as<uint32_t>() & yea_flag );
+
+   //voting again moves the votes, repeating a vote changes nothing
+   BOOST_REQUIRE_EQUAL( success(), voteproposal( voter, 0, false ) );
+   prop = get_proposal( 0 );
+   BOOST_REQUIRE_EQUAL( 0,              prop["total_yeas"].as_int64() );
+   BOOST_REQUIRE_EQUAL( votes + votes2, prop["total_nays"].as_int64() );
+   BOOST_REQUIRE_EQUAL( 0, get_proposal_vote( 0, voter )["vote_info"].as<uint32_t>() & yea_flag );
+   BOOST_REQUIRE_EQUAL( success(), voteproposal( voter, 0, false ) );
+   BOOST_REQUIRE_EQUAL( votes + votes2, get_proposal( 0 )["total_nays"].as_int64() );
+   BOOST_REQUIRE_EQUAL( success(), voteproposal( voter2, 0, true ) );
+   prop = get_proposal( 0 );
+   BOOST_REQUIRE_EQUAL( votes2, prop["total_yeas"].as_int64() );
+   BOOST_REQUIRE_EQUAL( votes,  prop["total_nays"].as_int64() );
+
+   //stake changes update the open proposals a voter voted on, 300000 staked tokens are 333 votes
+   BOOST_REQUIRE_EQUAL( success(), stake( voter, voter, core_sym::from_string("100000.0000"), core_sym::from_string("0.0000") ) );
+   prop = get_proposal( 0 );
+   BOOST_REQUIRE_EQUAL( votes2, prop["total_yeas"].as_int64() );
+   BOOST_REQUIRE_EQUAL( 333,    prop["total_nays"].as_int64() );
+
+   //but not the ended ones
+   produce_block( fc::days(2) );
+   BOOST_REQUIRE_EQUAL( success(), stake( voter2, voter2, core_sym::from_string("100000.0000"), core_sym::from_string("0.0000") ) );
+   BOOST_REQUIRE_EQUAL( votes2, get_proposal( 0 )["total_yeas"].as_int64() );
+
+   //no vote is kept in the propvote layout, so the migration completes at once
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg("must migrate at least one vote"),
+                        push_action( voter, N(migratepvote), mvo()("max", 0) ) );
+   BOOST_REQUIRE_EQUAL( success(), push_action( voter, N(migratepvote), mvo()("max", 10) ) );
+   BOOST_REQUIRE_EQUAL( true, get_global_state4()["proposal_votes_migrated"].as_bool() );
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg("proposal votes are already migrated"),
+                        push_action( voter, N(migratepvote), mvo()("max", 10) ) );
+
+   //votes are tallied the same once the old layout is no longer looked up
+   BOOST_REQUIRE_EQUAL( success(), newproposal( a, a, 1 ) );
+   BOOST_REQUIRE_EQUAL( success(), voteproposal( voter2, 1, true ) );
+   BOOST_REQUIRE_EQUAL( success(), stake( voter2, voter2, core_sym::from_string("100000.0000"), core_sym::from_string("0.0000") ) );
+   // 200000 staked tokens before and 300000 after the stake change
+   BOOST_REQUIRE_EQUAL( 333, get_proposal( 1 )["total_yeas"].as_int64() );
+   BOOST_REQUIRE_EQUAL( success(), voteproposal( voter2, 1, false ) );
+   prop = get_proposal( 1 );
+   BOOST_REQUIRE_EQUAL( 0,   prop["total_yeas"].as_int64() );
+   BOOST_REQUIRE_EQUAL( 333, prop["total_nays"].as_int64() );
+
+} FC_LOG_AND_RETHROW()
+
 BOOST_FIXTURE_TEST_CASE( vote_for_two_producers, eosio_system_tester, * boost::unit_test::tolerance(1e+5) ) try {
    //alice1111111 becomes a producer
    fc::variant params = producer_parameters_example(1);
@@ -1990,6 +2264,90 @@ BOOST_FIXTURE_TEST_CASE(votepay_share_invariant, eosio_system_tester, * boost::u
 
 } FC_LOG_AND_RETHROW()
 
+BOOST_FIXTURE_TEST_CASE(recompute_votepay_share, eosio_system_tester, * boost::unit_test::tolerance(1e-10)) try {
+
+   cross_15_percent_threshold();
+
+   const asset net = core_sym::from_string("80.0000");
+   const asset cpu = core_sym::from_string("80.0000");
+   const std::vector<account_name> accounts = { N(aliceaccount), N(bobbyaccount), N(carolaccount), N(emilyaccount) };
+   for (const auto& a: accounts) {
+      create_account_with_resources( a, config::system_account_name, core_sym::from_string("1.0000"), false, net, cpu );
+      transfer( config::system_account_name, a, core_sym::from_string("1000.0000"), config::system_account_name );
+   }
+   const auto vota  = accounts[0];
+   const auto votb  = accounts[1];
+   const auto proda = accounts[2];
+   const auto prodb = accounts[3];
+
+   BOOST_REQUIRE_EQUAL( success(), stake( vota, core_sym::from_string("100.0000"), core_sym::from_string("100.0000") ) );
+   BOOST_REQUIRE_EQUAL( success(), stake( votb, core_sym::from_string("200.0000"), core_sym::from_string("200.0000") ) );
+
+   BOOST_REQUIRE_EQUAL( success(), regproducer( proda ) );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( prodb ) );
+
+   BOOST_REQUIRE_EQUAL( success(), vote( vota, { proda } ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( votb, { proda, prodb } ) );
+
+   produce_block( fc::hours(10) );
+
+   BOOST_REQUIRE_EQUAL( error("missing authority of eosio"),
+                        push_action( vota, N(recompvpay), mvo() ) );
+   BOOST_REQUIRE_EQUAL( success(), push_action( config::system_account_name, N(recompvpay), mvo() ) );
+
+   BOOST_TEST_REQUIRE( 0 == get_producer_info2(proda)["votepay_share"].as_double() );
+   BOOST_TEST_REQUIRE( 0 == get_producer_info2(prodb)["votepay_share"].as_double() );
+   BOOST_TEST_REQUIRE( 0 == get_global_state2()["total_producer_votepay_share"].as_double() );
+   BOOST_TEST_REQUIRE( get_producer_info(proda)["total_votes"].as_double() + get_producer_info(prodb)["total_votes"].as_double()
+                       == get_global_state3()["total_vpay_share_change_rate"].as_double() );
+
+   // shares keep accumulating from the recomputed state
+   produce_block( fc::hours(1) );
+   BOOST_REQUIRE_EQUAL( success(), vote( vota, { proda } ) );
+   BOOST_TEST_REQUIRE( 0 < get_producer_info2(proda)["votepay_share"].as_double() );
+   BOOST_TEST_REQUIRE( 0 == get_producer_info2(prodb)["votepay_share"].as_double() );
+
+} FC_LOG_AND_RETHROW()
+
+BOOST_FIXTURE_TEST_CASE(votepay_share_fixed_point, eosio_system_tester, * boost::unit_test::tolerance(1e-10)) try {
+
+   cross_15_percent_threshold();
+
+   const asset net = core_sym::from_string("80.0000");
+   const asset cpu = core_sym::from_string("80.0000");
+   const std::vector<account_name> accounts = { N(aliceaccount), N(bobbyaccount) };
+   for (const auto& a: accounts) {
+      create_account_with_resources( a, config::system_account_name, core_sym::from_string("1.0000"), false, net, cpu );
+      transfer( config::system_account_name, a, core_sym::from_string("1000.0000"), config::system_account_name );
+   }
+   const auto alice = accounts[0];
+   const auto bob   = accounts[1];
+
+   // a new chain keeps votepay_share in fixed point from the first producer on
+   BOOST_REQUIRE_EQUAL( success(), regproducer( bob ) );
+   BOOST_REQUIRE_EQUAL( true, get_global_state4()["votepay_fixed_point"].as_bool() );
+   BOOST_REQUIRE_EQUAL( true, get_row_by_account( config::system_account_name, config::system_account_name, N(producers2), bob ).empty() );
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg("votepay share is already fixed point"),
+                        push_action( config::system_account_name, N(convertvpay), mvo() ) );
+
+   BOOST_REQUIRE_EQUAL( success(), stake( alice, core_sym::from_string("100.0000"), core_sym::from_string("100.0000") ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( alice, { bob } ) );
+   const double   total_votes = get_producer_info(bob)["total_votes"].as_double();
+   const uint64_t last_update = microseconds_since_epoch_of_iso_string( get_producer_votepay(bob)["last_votepay_share_update"] );
+
+   produce_block( fc::hours(10) );
+   BOOST_REQUIRE_EQUAL( success(), vote( alice, { bob } ) );
+
+   // same result as the floating point accounting, the votes are only truncated to whole votes
+   const auto     vpay    = get_producer_votepay(bob);
+   const uint64_t elapsed = microseconds_since_epoch_of_iso_string( vpay["last_votepay_share_update"] ) - last_update;
+   BOOST_TEST_REQUIRE( std::floor(total_votes) * elapsed == uint128_to_double( vpay["votepay_share"] ) );
+   BOOST_TEST_REQUIRE( total_votes * ( elapsed / 1E6 ) == get_producer_info2(bob)["votepay_share"].as_double() );
+   BOOST_TEST_REQUIRE( total_votes * ( elapsed / 1E6 ) == get_global_state2()["total_producer_votepay_share"].as_double() );
+   BOOST_TEST_REQUIRE( get_producer_info(bob)["total_votes"].as_double() == get_global_state3()["total_vpay_share_change_rate"].as_double() );
+
+} FC_LOG_AND_RETHROW()
+
 BOOST_FIXTURE_TEST_CASE(votepay_share_proxy, eosio_system_tester, * boost::unit_test::tolerance(1e-5)) try {
 
    cross_15_percent_threshold();
@@ -2205,6 +2563,31 @@ BOOST_FIXTURE_TEST_CASE(votepay_share_update_order, eosio_system_tester, * boost
    BOOST_TEST_REQUIRE( carol_info["total_votes"].as_double() == emily_info["total_votes"].as_double() );
    BOOST_TEST_REQUIRE( gs3["total_vpay_share_change_rate"].as_double() == 2 * carol_info["total_votes"].as_double() );
 
+   produce_block( fc::hours(25) );
+
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg("producers must be unique"),
+                        push_action( carol, N(claimrwdsn), mvo()("owners", std::vector<account_name>{ carol, carol }) ) );
+
+   // both producers claim in one action which needs both authorizations
+   BOOST_REQUIRE_EQUAL( error("missing authority of emilyaccount"),
+                        push_action( carol, N(claimrwdsn), mvo()("owners", std::vector<account_name>{ carol, emily }) ) );
+   {
+      signed_transaction trx;
+      set_transaction_headers(trx);
+
+      trx.actions.emplace_back( get_action( config::system_account_name, N(claimrwdsn),
+                                            { {carol, config::active_name}, {emily, config::active_name} },
+                                            mvo()("owners", std::vector<account_name>{ carol, emily }) ) );
+
+      trx.sign( get_private_key( carol, "active" ), control->get_chain_id() );
+      trx.sign( get_private_key( emily, "active" ), control->get_chain_id() );
+
+      push_transaction( trx );
+   }
+   const auto claim_time = get_producer_info(carol)["last_claim_time"].as_string();
+   BOOST_REQUIRE( claim_time != carol_info["last_claim_time"].as_string() );
+   BOOST_REQUIRE_EQUAL( claim_time, get_producer_info(emily)["last_claim_time"].as_string() );
+
 } FC_LOG_AND_RETHROW()
 
 BOOST_FIXTURE_TEST_CASE(votepay_transition, eosio_system_tester, * boost::unit_test::tolerance(1e-10)) try {
@@ -2350,6 +2733,128 @@ BOOST_AUTO_TEST_CASE(votepay_transition2, * boost::unit_test::tolerance(1e-10))
 } FC_LOG_AND_RETHROW()
 
 
+BOOST_AUTO_TEST_CASE(votepay_convert, * boost::unit_test::tolerance(1e-10)) try {
+   eosio_system_tester t(eosio_system_tester::setup_level::minimal);
+
+   std::string old_contract_core_symbol_name = "EON"; // Set to core symbol used in contracts::util::system_wasm_old()
+   symbol old_contract_core_symbol{::eosio::chain::string_to_symbol_c( 4, old_contract_core_symbol_name.c_str() )};
+
+   auto old_core_from_string = [&]( const std::string& s ) {
+      return eosio::chain::asset::from_string(s + " " + old_contract_core_symbol_name);
+   };
+
+   t.create_core_token( old_contract_core_symbol );
+   t.set_code( config::system_account_name, contracts::util::system_wasm_old() );
+   t.set_abi(  config::system_account_name, contracts::util::system_abi_old().data() );
+   {
+      const auto& accnt = t.control->db().get<account_object,by_name>( config::system_account_name );
+      abi_def abi;
+      BOOST_REQUIRE_EQUAL(abi_serializer::to_abi(accnt.abi, abi), true);
+      t.abi_ser.set_abi(abi, eosio_system_tester::abi_serializer_max_time);
+   }
+   const asset net = old_core_from_string("80.0000");
+   const asset cpu = old_core_from_string("80.0000");
+   const std::vector<account_name> voters = { N(producvotera), N(producvoterb), N(producvoterc), N(producvoterd) };
+   for (const auto& v: voters) {
+      t.create_account_with_resources( v, config::system_account_name, old_core_from_string("1.0000"), false, net, cpu );
+      t.transfer( config::system_account_name, v, old_core_from_string("100000000.0000"), config::system_account_name );
+      BOOST_REQUIRE_EQUAL(t.success(), t.stake(v, old_core_from_string("30000000.0000"), old_core_from_string("30000000.0000")) );
+   }
+
+   std::vector<account_name> producer_names;
+   {
+      const std::string root("defproducer");
+      for ( char c = 'a'; c <= 'd'; ++c ) {
+         producer_names.emplace_back(root + std::string(1, c));
+      }
+      t.setup_producer_accounts( producer_names, old_core_from_string("1.0000"),
+                                 old_core_from_string("80.0000"), old_core_from_string("80.0000") );
+      for (const auto& p: producer_names) {
+         BOOST_REQUIRE_EQUAL( t.success(), t.regproducer(p) );
+      }
+   }
+   // activates the chain
+   BOOST_REQUIRE_EQUAL( t.success(), t.vote(N(producvotera), producer_names) );
+   BOOST_REQUIRE_EQUAL( t.success(), t.vote(N(producvoterb), producer_names) );
+   BOOST_REQUIRE_EQUAL( t.success(), t.vote(N(producvoterc), producer_names) );
+   t.produce_block( fc::hours(20) );
+
+   // producers of the old contract keep votepay_share in doubles
+   t.deploy_contract( false );
+   t.produce_blocks(2);
+   BOOST_REQUIRE_EQUAL( t.success(), t.regproducer(producer_names[0]) );
+   BOOST_REQUIRE_EQUAL( false, t.get_global_state4()["votepay_fixed_point"].as_bool() );
+
+   // the first producer stops accumulating votepay_share when it is updated 3 days after its last claim
+   t.produce_block( fc::days(4) );
+   BOOST_REQUIRE_EQUAL( t.success(), t.vote(N(producvoterd), { producer_names[0] }) );
+   BOOST_TEST_REQUIRE( 0 == t.get_producer_info2(producer_names[0])["votepay_share"].as_double() );
+
+   // the others accumulate it again after a claim
+   for (size_t i = 1; i < producer_names.size(); ++i) {
+      BOOST_REQUIRE_EQUAL( t.success(), t.regproducer(producer_names[i]) );
+      BOOST_REQUIRE_EQUAL( t.success(), t.push_action(producer_names[i], N(claimrewards), mvo()("owner", producer_names[i])) );
+   }
+   t.produce_block( fc::hours(10) );
+   BOOST_REQUIRE_EQUAL( t.success(), t.vote(N(producvotera), producer_names) );
+   t.produce_block( fc::hours(10) );
+   BOOST_REQUIRE_EQUAL( t.success(), t.vote(N(producvoterb), producer_names) );
+   BOOST_TEST_REQUIRE( 0 == t.get_producer_info2(producer_names[0])["votepay_share"].as_double() );
+   std::vector<fc::variant> prods2;
+   for (const auto& p: producer_names) {
+      BOOST_REQUIRE( t.get_producer_votepay(p).is_null() );
+      prods2.push_back( t.get_producer_info2(p) );
+   }
+   for (size_t i = 1; i < producer_names.size(); ++i) {
+      BOOST_TEST_REQUIRE( 0 < prods2[i]["votepay_share"].as_double() );
+   }
+   BOOST_TEST_REQUIRE( 0 < t.get_global_state2()["total_producer_votepay_share"].as_double() );
+
+   t.produce_block( fc::hours(1) );
+   BOOST_REQUIRE_EQUAL( t.error("missing authority of eosio"), t.push_action( N(producvotera), N(convertvpay), mvo() ) );
+   BOOST_REQUIRE_EQUAL( t.success(), t.push_action( config::system_account_name, N(convertvpay), mvo() ) );
+   const uint64_t convert_time = t.control->head_block_time().time_since_epoch().count();
+
+   // every share and vote count is truncated on its own and the totals are their sums
+   unsigned __int128 total_votepay_share = 0;
+   unsigned __int128 change_rate         = 0;
+   for (size_t i = 0; i < producer_names.size(); ++i) {
+      const auto vpay = t.get_producer_votepay(producer_names[i]);
+      const unsigned __int128 votepay_share = static_cast<unsigned __int128>( prods2[i]["votepay_share"].as_double() * 1E6 );
+      BOOST_REQUIRE( votepay_share == eosio_system_tester::to_uint128( vpay["votepay_share"] ) );
+      BOOST_REQUIRE_EQUAL( prods2[i]["last_votepay_share_update"].as_string(), vpay["last_votepay_share_update"].as_string() );
+      BOOST_REQUIRE( t.get_row_by_account( config::system_account_name, config::system_account_name, N(producers2), producer_names[i] ).empty() );
+      total_votepay_share += votepay_share;
+      if ( i > 0 ) {
+         const unsigned __int128 votes = static_cast<unsigned __int128>( t.get_producer_info(producer_names[i])["total_votes"].as_double() );
+         const uint64_t last_update = t.microseconds_since_epoch_of_iso_string( vpay["last_votepay_share_update"] );
+         change_rate         += votes;
+         total_votepay_share += votes * ( convert_time - last_update );
+      }
+   }
+   auto gs4 = t.get_global_state4();
+   BOOST_REQUIRE_EQUAL( true, gs4["votepay_fixed_point"].as_bool() );
+   BOOST_REQUIRE( total_votepay_share == eosio_system_tester::to_uint128( gs4["total_votepay_share"] ) );
+   BOOST_REQUIRE( change_rate         == eosio_system_tester::to_uint128( gs4["vpay_share_change_rate"] ) );
+   BOOST_REQUIRE_EQUAL( t.wasm_assert_msg("votepay share is already fixed point"),
+                        t.push_action( config::system_account_name, N(convertvpay), mvo() ) );
+
+   // the shares keep accumulating in integers
+   const auto p = producer_names[1];
+   const unsigned __int128 init_share = eosio_system_tester::to_uint128( t.get_producer_votepay(p)["votepay_share"] );
+   const uint64_t          init_time  = t.microseconds_since_epoch_of_iso_string( t.get_producer_votepay(p)["last_votepay_share_update"] );
+   const unsigned __int128 init_votes = static_cast<unsigned __int128>( t.get_producer_info(p)["total_votes"].as_double() );
+   t.produce_block( fc::hours(1) );
+   BOOST_REQUIRE_EQUAL( t.success(), t.vote(N(producvoterd), { p }) );
+   const uint64_t vote_time = t.control->head_block_time().time_since_epoch().count();
+   BOOST_REQUIRE( init_share + init_votes * ( vote_time - init_time ) == eosio_system_tester::to_uint128( t.get_producer_votepay(p)["votepay_share"] ) );
+   gs4 = t.get_global_state4();
+   BOOST_REQUIRE( change_rate - init_votes + static_cast<unsigned __int128>( t.get_producer_info(p)["total_votes"].as_double() )
+                  == eosio_system_tester::to_uint128( gs4["vpay_share_change_rate"] ) );
+
+} FC_LOG_AND_RETHROW()
+
+
 BOOST_FIXTURE_TEST_CASE(producers_upgrade_system_contract, eosio_system_tester) try {
    //install multisig contract
    abi_serializer msig_abi_ser = initialize_multisig();
@@ -2630,6 +3135,11 @@ BOOST_FIXTURE_TEST_CASE( voters_actions_affect_proxy_and_producers, eosio_system
    BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("100.0003")), get_producer_info( "defproducer2" )["total_votes"].as_double() );
    BOOST_TEST_REQUIRE( 0.0 == get_producer_info( "defproducer3" )["total_votes"].as_double() );
 
+   //the proxied weight was already pushed to the producers by onblock
+   BOOST_REQUIRE_EQUAL( true, get_row_by_account( config::system_account_name, config::system_account_name, N(dirtyproxies), N(alice1111111) ).empty() );
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg("proxy has no pending vote weight"),
+                        push_action( N(bob111111111), N(refreshproxy), mvo()("proxy", "alice1111111") ) );
+
 } FC_LOG_AND_RETHROW()
 
 
@@ -2940,9 +3450,14 @@ BOOST_FIXTURE_TEST_CASE( multiple_namebids, eosio_system_tester ) try {
       const asset initial_names_balance = get_balance(N(eonio.names));
       BOOST_REQUIRE_EQUAL( success(),
                            bidname( "alice", "prefb", core_sym::from_string("1.1001") ) );
-      BOOST_REQUIRE_EQUAL( core_sym::from_string( "9997.9997" ), get_balance("bob") );
+      // bob's bid is held by eonio.names until the refund is claimed
+      BOOST_REQUIRE_EQUAL( core_sym::from_string( "9996.9997" ), get_balance("bob") );
       BOOST_REQUIRE_EQUAL( core_sym::from_string( "9998.8999" ), get_balance("alice") );
+      BOOST_REQUIRE_EQUAL( initial_names_balance + core_sym::from_string("1.1001"), get_balance(N(eonio.names)) );
+      BOOST_REQUIRE_EQUAL( success(), bidrefund( "bob", "prefb" ) );
+      BOOST_REQUIRE_EQUAL( core_sym::from_string( "9997.9997" ), get_balance("bob") );
       BOOST_REQUIRE_EQUAL( initial_names_balance + core_sym::from_string("0.1001"), get_balance(N(eonio.names)) );
+      BOOST_REQUIRE_EQUAL( wasm_assert_msg( "refund not found" ), bidrefund( "bob", "prefb" ) );
    }
 
    // david outbids carl on prefd
@@ -2951,8 +3466,12 @@ BOOST_FIXTURE_TEST_CASE( multiple_namebids, eosio_system_tester ) try {
       BOOST_REQUIRE_EQUAL( core_sym::from_string( "10000.0000" ), get_balance("david") );
       BOOST_REQUIRE_EQUAL( success(),
                            bidname( "david", "prefd", core_sym::from_string("1.9900") ) );
+      BOOST_REQUIRE_EQUAL( core_sym::from_string( "9998.0000" ), get_balance("carl") );
+      // anyone can pay out outstanding refunds
+      BOOST_REQUIRE_EQUAL( success(), sweepbids( "eve", 10 ) );
       BOOST_REQUIRE_EQUAL( core_sym::from_string( "9999.0000" ), get_balance("carl") );
       BOOST_REQUIRE_EQUAL( core_sym::from_string( "9998.0100" ), get_balance("david") );
+      BOOST_REQUIRE_EQUAL( wasm_assert_msg( "no refunds to sweep" ), sweepbids( "eve", 10 ) );
    }
 
    // eve outbids carl on prefe
@@ -3577,6 +4096,7 @@ BOOST_FIXTURE_TEST_CASE( unstake_buy_rex, eosio_system_tester, * boost::unit_tes
       BOOST_REQUIRE_EQUAL( get_net_limit( alice ),                  init_net_limit );
       BOOST_REQUIRE_EQUAL( ratio * tot_stake.get_amount(),          get_rex_balance( alice ).get_amount() );
       BOOST_REQUIRE_EQUAL( tot_stake,                               get_rex_balance_obj( alice )["vote_stake"].as<asset>() );
+      BOOST_REQUIRE_EQUAL( success(),                               reconcile() );
       BOOST_REQUIRE_EQUAL( tot_stake,                               get_balance( N(eonio.rex) ) );
       BOOST_REQUIRE_EQUAL( tot_stake,                               init_eosio_stake_balance - get_balance( N(eonio.stake) ) );
       auto current_voter_info = get_voter_info( alice );
@@ -4112,6 +4632,7 @@ BOOST_FIXTURE_TEST_CASE( ramfee_namebid_to_rex, eosio_system_tester ) try {
    asset cur_rex_balance = get_balance( N(eonio.rex) );
    BOOST_REQUIRE_EQUAL( core_sym::from_string("350.0000"), cur_rex_balance );
    BOOST_REQUIRE_EQUAL( success(),                         buyram( bob, carol, core_sym::from_string("70.0000") ) );
+   BOOST_REQUIRE_EQUAL( success(),                         reconcile() );
    BOOST_REQUIRE_EQUAL( cur_ramfee_balance,                get_balance( N(eonio.ramfee) ) );
    BOOST_REQUIRE_EQUAL( get_balance( N(eonio.rex) ),       cur_rex_balance + core_sym::from_string("0.3500") );
 
@@ -4131,6 +4652,7 @@ BOOST_FIXTURE_TEST_CASE( ramfee_namebid_to_rex, eosio_system_tester ) try {
    BOOST_REQUIRE_EQUAL( success(),                        bidname( carol, N(rndmbid), core_sym::from_string("23.7000") ) );
    BOOST_REQUIRE_EQUAL( core_sym::from_string("23.7000"), get_balance( N(eonio.names) ) );
    BOOST_REQUIRE_EQUAL( success(),                        bidname( alice, N(rndmbid), core_sym::from_string("29.3500") ) );
+   BOOST_REQUIRE_EQUAL( success(),                        bidrefund( carol, N(rndmbid) ) );
    BOOST_REQUIRE_EQUAL( core_sym::from_string("29.3500"), get_balance( N(eonio.names) ));
 
    produce_block( fc::hours(24) );
@@ -4139,6 +4661,7 @@ BOOST_FIXTURE_TEST_CASE( ramfee_namebid_to_rex, eosio_system_tester ) try {
    BOOST_REQUIRE_EQUAL( core_sym::from_string("29.3500"), get_rex_pool()["namebid_proceeds"].as<asset>() );
    BOOST_REQUIRE_EQUAL( success(),                        deposit( frank, core_sym::from_string("5.0000") ) );
    BOOST_REQUIRE_EQUAL( success(),                        buyrex( frank, core_sym::from_string("5.0000") ) );
+   BOOST_REQUIRE_EQUAL( success(),                        reconcile() );
    BOOST_REQUIRE_EQUAL( get_balance( N(eonio.rex) ),      cur_rex_balance + core_sym::from_string("34.3500") );
    BOOST_REQUIRE_EQUAL( 0,                                get_balance( N(eonio.names) ).get_amount() );
 
@@ -4149,6 +4672,52 @@ BOOST_FIXTURE_TEST_CASE( ramfee_namebid_to_rex, eosio_system_tester ) try {
 } FC_LOG_AND_RETHROW()
 
 
+BOOST_FIXTURE_TEST_CASE( system_ledger_reconcile, eosio_system_tester ) try {
+
+   const asset init_balance = core_sym::from_string("1000.0000");
+   const std::vector<account_name> accounts = { N(aliceaccount), N(bobbyaccount) };
+   account_name alice = accounts[0], bob = accounts[1];
+   setup_rex_accounts( accounts, init_balance );
+
+   BOOST_REQUIRE_EQUAL( success(), buyrex( alice, core_sym::from_string("100.0000") ) );
+
+   const asset init_stake_balance = get_balance( N(eonio.stake) );
+   const asset init_rex_balance   = get_balance( N(eonio.rex) );
+   BOOST_REQUIRE_EQUAL( success(), unstaketorex( bob, bob, core_sym::from_string("4.0000"), core_sym::from_string("6.0000") ) );
+   // tokens moved on the system ledger stay on it until the ledger is reconciled
+   BOOST_REQUIRE_EQUAL( -10'0000, get_ledger_entry( N(eonio.stake) )["balance"].as<int64_t>() );
+   BOOST_REQUIRE_EQUAL(  10'0000, get_ledger_entry( N(eonio.rex) )["balance"].as<int64_t>() );
+   BOOST_REQUIRE_EQUAL( init_stake_balance, get_balance( N(eonio.stake) ) );
+   BOOST_REQUIRE_EQUAL( init_rex_balance,   get_balance( N(eonio.rex) ) );
+
+   // reconciliation is permissionless
+   BOOST_REQUIRE_EQUAL( success(), reconcile( bob ) );
+   BOOST_REQUIRE_EQUAL( true, get_ledger_entry( N(eonio.stake) ).is_null() );
+   BOOST_REQUIRE_EQUAL( true, get_ledger_entry( N(eonio.rex) ).is_null() );
+   BOOST_REQUIRE_EQUAL( init_stake_balance - core_sym::from_string("10.0000"), get_balance( N(eonio.stake) ) );
+   BOOST_REQUIRE_EQUAL( init_rex_balance + core_sym::from_string("10.0000"),   get_balance( N(eonio.rex) ) );
+   BOOST_REQUIRE_EQUAL( get_balance( N(eonio.rex) ), get_rex_pool()["total_lendable"].as<asset>() );
+
+   // and a no-op on a settled ledger
+   BOOST_REQUIRE_EQUAL( success(), reconcile( bob ) );
+   BOOST_REQUIRE_EQUAL( init_rex_balance + core_sym::from_string("10.0000"), get_balance( N(eonio.rex) ) );
+
+   // onblock reconciles the ledger once an hour
+   BOOST_REQUIRE_EQUAL( success(), unstaketorex( bob, bob, core_sym::from_string("1.0000"), core_sym::from_string("1.0000") ) );
+   BOOST_REQUIRE_EQUAL( false, get_ledger_entry( N(eonio.rex) ).is_null() );
+   produce_block( fc::hours(1) );
+   produce_blocks( 2 );
+   BOOST_REQUIRE_EQUAL( true, get_ledger_entry( N(eonio.stake) ).is_null() );
+   BOOST_REQUIRE_EQUAL( true, get_ledger_entry( N(eonio.rex) ).is_null() );
+   BOOST_REQUIRE_EQUAL( init_rex_balance + core_sym::from_string("12.0000"), get_balance( N(eonio.rex) ) );
+
+   // withdrawals settle the REX balance at once
+   BOOST_REQUIRE_EQUAL( success(), withdraw( alice, core_sym::from_string("900.0000") ) );
+   BOOST_REQUIRE_EQUAL( core_sym::from_string("900.0000"), get_balance( alice ) );
+
+} FC_LOG_AND_RETHROW()
+
+
 BOOST_FIXTURE_TEST_CASE( rex_maturity, eosio_system_tester ) try {
 
    const asset init_balance = core_sym::from_string("1000000.0000");
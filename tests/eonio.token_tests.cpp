@@ -2,10 +2,14 @@
 #include <eosio/testing/tester.hpp>
 #include <eosio/chain/abi_serializer.hpp>
 #include "eonio.system_tester.hpp"
+#include "genesis_loader/genesis_loader.hpp"
 
 #include "Runtime/Runtime.h"
 
 #include <fc/variant_object.hpp>
+#include <fc/filesystem.hpp>
+
+#include <fstream>
 
 using namespace eosio::testing;
 using namespace eosio;
@@ -100,6 +104,20 @@ public:
       );
    }
 
+   action_result transfern( account_name from,
+                            const vector<std::pair<account_name,asset>>& transfers,
+                            string       memo ) {
+      vector<variant> ts;
+      for( const auto& t : transfers ) {
+         ts.push_back( mvo()("first", t.first)("second", t.second) );
+      }
+      return push_action( from, N(transfern), mvo()
+           ( "from", from)
+           ( "transfers", ts)
+           ( "memo", memo)
+      );
+   }
+
    action_result open( account_name owner,
                        const string& symbolname,
                        account_name ram_payer    ) {
@@ -240,6 +258,51 @@ BOOST_FIXTURE_TEST_CASE( issue_tests, eosio_token_tester ) try {
       issue( N(alice), N(alice), asset::from_string("1.000 TKN"), "hola" )
    );
 
+   BOOST_REQUIRE_EQUAL( success(),
+      issue( N(alice), N(bob), asset::from_string("2.000 TKN"), "hola" )
+   );
+   REQUIRE_MATCHING_OBJECT( get_stats("3,TKN"), mvo()
+      ("supply", "503.000 TKN")
+      ("max_supply", "1000.000 TKN")
+      ("issuer", "alice")
+   );
+   REQUIRE_MATCHING_OBJECT( get_account(N(alice), "3,TKN"), mvo()
+      ("balance", "501.000 TKN")
+   );
+   REQUIRE_MATCHING_OBJECT( get_account(N(bob), "3,TKN"), mvo()
+      ("balance", "2.000 TKN")
+   );
+
+
+} FC_LOG_AND_RETHROW()
+
+BOOST_FIXTURE_TEST_CASE( issue_notifies_recipient, eosio_token_tester ) try {
+
+   create( N(alice), asset::from_string("1000.000 TKN"));
+   produce_blocks(1);
+
+   auto trace = base_tester::push_action( N(eonio.token), N(issue), N(alice), mvo()
+      ( "to", "bob")
+      ( "quantity", "2.000 TKN")
+      ( "memo", "hola")
+   );
+
+   // the recipient is notified whether it is credited directly or by an inline transfer
+   std::function<bool(const action_trace&)> notifies_bob = [&]( const action_trace& at ) {
+      if( at.receipt.receiver == N(bob) )
+         return true;
+      return std::any_of( at.inline_traces.begin(), at.inline_traces.end(), notifies_bob );
+   };
+   BOOST_REQUIRE_EQUAL( 1, trace->action_traces.size() );
+   BOOST_REQUIRE( notifies_bob( trace->action_traces[0] ) );
+
+   REQUIRE_MATCHING_OBJECT( get_account(N(bob), "3,TKN"), mvo()
+      ("balance", "2.000 TKN")
+   );
+
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg( "to account does not exist" ),
+      issue( N(alice), N(dave), asset::from_string("1.000 TKN"), "hola" )
+   );
 
 } FC_LOG_AND_RETHROW()
 
@@ -343,6 +406,146 @@ BOOST_FIXTURE_TEST_CASE( transfer_tests, eosio_token_tester ) try {
       transfer( N(alice), N(bob), asset::from_string("-1000 CERO"), "hola" )
    );
 
+   BOOST_REQUIRE_EQUAL( success(), transfer( N(alice), N(bob), asset::from_string("1 CERO"), string(256, 'a') ) );
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg( "memo has more than 256 bytes" ),
+      transfer( N(alice), N(bob), asset::from_string("1 CERO"), string(257, 'a') )
+   );
+
+
+} FC_LOG_AND_RETHROW()
+
+BOOST_FIXTURE_TEST_CASE( core_symbol_transfer_tests, eosio_token_tester ) try {
+
+   // built with 4,TKN as the core symbol, the same abi
+   set_code( N(eonio.token), contracts::token_coresym_wasm() );
+   produce_blocks();
+
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg( "core symbol precision mismatch" ),
+      create( N(alice), asset::from_string("1000.000 TKN") )
+   );
+   BOOST_REQUIRE_EQUAL( success(), create( N(alice), asset::from_string("1000.0000 TKN") ) );
+   BOOST_REQUIRE_EQUAL( success(), create( N(alice), asset::from_string("1000 CERO") ) );
+   BOOST_REQUIRE_EQUAL( success(), issue( N(alice), N(alice), asset::from_string("1000.0000 TKN"), "hola" ) );
+   BOOST_REQUIRE_EQUAL( success(), issue( N(alice), N(alice), asset::from_string("1000 CERO"), "hola" ) );
+
+   // the core symbol is checked against its configured precision, others against their stat row
+   BOOST_REQUIRE_EQUAL( success(), transfer( N(alice), N(bob), asset::from_string("1.0000 TKN"), "hola" ) );
+   BOOST_REQUIRE_EQUAL( success(), transfer( N(alice), N(bob), asset::from_string("1 CERO"), "hola" ) );
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg( "symbol precision mismatch" ),
+      transfer( N(alice), N(bob), asset::from_string("1.000 TKN"), "hola" )
+   );
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg( "symbol precision mismatch" ),
+      transfer( N(alice), N(bob), asset::from_string("1.0 CERO"), "hola" )
+   );
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg( "symbol precision mismatch" ),
+      transfern( N(alice), { { N(bob), asset::from_string("1.000 TKN") } }, "hola" )
+   );
+
+   REQUIRE_MATCHING_OBJECT( get_account(N(bob), "4,TKN"), mvo()
+      ("balance", "1.0000 TKN")
+   );
+   REQUIRE_MATCHING_OBJECT( get_account(N(bob), "0,CERO"), mvo()
+      ("balance", "1 CERO")
+   );
+
+} FC_LOG_AND_RETHROW()
+
+BOOST_FIXTURE_TEST_CASE( transfern_tests, eosio_token_tester ) try {
+
+   create( N(alice), asset::from_string("1000 CERO"));
+   create( N(alice), asset::from_string("1000.000 TKN"));
+   issue( N(alice), N(alice), asset::from_string("1000 CERO"), "hola" );
+   issue( N(alice), N(alice), asset::from_string("1000.000 TKN"), "hola" );
+   produce_blocks(1);
+
+   BOOST_REQUIRE_EQUAL( success(), transfern( N(alice), {
+      { N(bob),   asset::from_string("300 CERO") },
+      { N(carol), asset::from_string("200 CERO") },
+      { N(bob),   asset::from_string("1.500 TKN") },
+      { N(bob),   asset::from_string("100 CERO") }
+   }, "hola" ) );
+
+   REQUIRE_MATCHING_OBJECT( get_account(N(alice), "0,CERO"), mvo()
+      ("balance", "400 CERO")
+   );
+   REQUIRE_MATCHING_OBJECT( get_account(N(alice), "3,TKN"), mvo()
+      ("balance", "998.500 TKN")
+   );
+   REQUIRE_MATCHING_OBJECT( get_account(N(bob), "0,CERO"), mvo()
+      ("balance", "400 CERO")
+   );
+   REQUIRE_MATCHING_OBJECT( get_account(N(bob), "3,TKN"), mvo()
+      ("balance", "1.500 TKN")
+   );
+   REQUIRE_MATCHING_OBJECT( get_account(N(carol), "0,CERO"), mvo()
+      ("balance", "200 CERO")
+   );
+
+   /// the sum of the transfers of a symbol is checked against the balance
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg( "overdrawn balance" ),
+      transfern( N(alice), { { N(bob), asset::from_string("300 CERO") }, { N(carol), asset::from_string("101 CERO") } }, "hola" )
+   );
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg( "cannot transfer to self" ),
+      transfern( N(alice), { { N(bob), asset::from_string("1 CERO") }, { N(alice), asset::from_string("1 CERO") } }, "hola" )
+   );
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg( "must transfer positive quantity" ),
+      transfern( N(alice), { { N(bob), asset::from_string("-1 CERO") } }, "hola" )
+   );
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg( "symbol precision mismatch" ),
+      transfern( N(alice), { { N(bob), asset::from_string("1 CERO") }, { N(carol), asset::from_string("1.0 CERO") } }, "hola" )
+   );
+
+} FC_LOG_AND_RETHROW()
+
+BOOST_FIXTURE_TEST_CASE( genesis_loader_tests, eosio_token_tester ) try {
+
+   create( N(alice), asset::from_string("1000.0000 TKN"));
+   issue( N(alice), N(alice), asset::from_string("1000.0000 TKN"), "hola" );
+   produce_blocks(1);
+
+   fc::temp_directory tempdir;
+   auto path = (tempdir.path() / "balances.csv").generic_string();
+   {
+      std::ofstream out( path );
+      out << "# account,quantity\n\nbob,1.0000 TKN\r\ncarol,2.5000 TKN";
+   }
+
+   eosio_genesis::mapped_file    file( path );
+   eosio_genesis::balance_reader reader( file.contents() );
+   eosio_genesis::transfern_args args{ N(alice), {}, "genesis" };
+   eosio_genesis::transfer_entry entry;
+   while( reader.next( entry.to, entry.quantity ) ) {
+      args.transfers.push_back( entry );
+   }
+   BOOST_REQUIRE_EQUAL( 2u, args.transfers.size() );
+   BOOST_REQUIRE_EQUAL( name(N(bob)), args.transfers[0].to );
+   BOOST_REQUIRE_EQUAL( "1.0000 TKN", args.transfers[0].quantity.to_string() );
+   BOOST_REQUIRE_EQUAL( name(N(carol)), args.transfers[1].to );
+   BOOST_REQUIRE_EQUAL( "2.5000 TKN", args.transfers[1].quantity.to_string() );
+
+   /// the packed balances match the abi of transfern
+   auto data = abi_ser.variant_to_binary( abi_ser.get_action_type(N(transfern)), mvo()
+      ("from", "alice")
+      ("transfers", fc::variants{ mvo()("first", "bob")("second", "1.0000 TKN"),
+                                  mvo()("first", "carol")("second", "2.5000 TKN") })
+      ("memo", "genesis"), abi_serializer_max_time );
+   BOOST_REQUIRE( data == fc::raw::pack( args ) );
+
+   signed_transaction header;
+   set_transaction_headers( header );
+   push_transaction( eosio_genesis::make_transfern_trx( args, N(eonio.token), header,
+                                                        get_private_key( N(alice), "active" ), control->get_chain_id() ) );
+   produce_blocks(1);
+
+   REQUIRE_MATCHING_OBJECT( get_account(N(alice), "4,TKN"), mvo()
+      ("balance", "996.5000 TKN")
+   );
+   REQUIRE_MATCHING_OBJECT( get_account(N(bob), "4,TKN"), mvo()
+      ("balance", "1.0000 TKN")
+   );
+   REQUIRE_MATCHING_OBJECT( get_account(N(carol), "4,TKN"), mvo()
+      ("balance", "2.5000 TKN")
+   );
 
 } FC_LOG_AND_RETHROW()
 
@@ -0,0 +1,124 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+
+#include <eosio/chain/asset.hpp>
+#include <eosio/chain/transaction.hpp>
+
+#include <fc/reflect/reflect.hpp>
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace eosio_genesis {
+
+using namespace eosio::chain;
+
+/**
+ *  Read-only memory mapping of a whole file.
+ */
+class mapped_file {
+public:
+   explicit mapped_file( const std::string& path ) {
+      int fd = ::open( path.c_str(), O_RDONLY );
+      FC_ASSERT( fd >= 0, "unable to open ${p}", ("p", path) );
+      struct stat st;
+      if( ::fstat( fd, &st ) == 0 && st.st_size > 0 ) {
+         _size = st.st_size;
+         _data = ::mmap( nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0 );
+      }
+      ::close( fd );
+      FC_ASSERT( _data != MAP_FAILED, "unable to map ${p}", ("p", path) );
+      if( _data )
+         ::madvise( _data, _size, MADV_SEQUENTIAL );
+   }
+   ~mapped_file() {
+      if( _data && _data != MAP_FAILED )
+         ::munmap( _data, _size );
+   }
+   mapped_file( const mapped_file& ) = delete;
+   mapped_file& operator=( const mapped_file& ) = delete;
+
+   std::string_view contents()const { return { static_cast<const char*>(_data), _data ? _size : 0 }; }
+
+private:
+   void*  _data = nullptr;
+   size_t _size = 0;
+};
+
+/**
+ *  Reads "account,quantity" lines from a balance file, e.g. "alice,10.0000 TST". Blank lines and
+ *  lines starting with # are skipped.
+ */
+class balance_reader {
+public:
+   explicit balance_reader( std::string_view contents ) : _rest(contents) {}
+
+   bool next( account_name& account, asset& quantity ) {
+      while( !_rest.empty() ) {
+         auto eol  = _rest.find( '\n' );
+         auto line = _rest.substr( 0, eol );
+         _rest = eol == std::string_view::npos ? std::string_view() : _rest.substr( eol + 1 );
+         ++_line;
+
+         if( !line.empty() && line.back() == '\r' )
+            line.remove_suffix( 1 );
+         if( line.empty() || line.front() == '#' )
+            continue;
+
+         auto comma = line.find( ',' );
+         FC_ASSERT( comma != std::string_view::npos, "line ${l}: expected account,quantity", ("l", _line) );
+         account  = account_name( std::string( line.substr( 0, comma ) ) );
+         quantity = asset::from_string( std::string( line.substr( comma + 1 ) ) );
+         return true;
+      }
+      return false;
+   }
+
+private:
+   std::string_view _rest;
+   uint64_t         _line = 0;
+};
+
+struct transfer_entry {
+   account_name to;
+   asset        quantity;
+};
+
+/// action data of eonio.token::transfern
+struct transfern_args {
+   account_name                from;
+   std::vector<transfer_entry> transfers;
+   std::string                 memo;
+};
+
+} /// namespace eosio_genesis
+
+FC_REFLECT( eosio_genesis::transfer_entry, (to)(quantity) )
+FC_REFLECT( eosio_genesis::transfern_args, (from)(transfers)(memo) )
+
+namespace eosio_genesis {
+
+/**
+ *  Packs one eonio.token::transfern of args into a transaction with the given header and signs it.
+ */
+inline signed_transaction make_transfern_trx( const transfern_args& args, account_name token_account,
+                                              const transaction_header& header,
+                                              const private_key_type& key, const chain_id_type& chain_id ) {
+   signed_transaction trx;
+   static_cast<transaction_header&>( trx ) = header;
+   trx.actions.emplace_back( vector<permission_level>{ { args.from, config::active_name } },
+                             token_account, N(transfern), fc::raw::pack( args ) );
+   trx.sign( key, chain_id );
+   return trx;
+}
+
+} /// namespace eosio_genesis
@@ -0,0 +1,221 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ *
+ *  Loads the balances of a genesis balance file into a running node:
+ *
+ *     genesis_loader <balances.csv> <http endpoint> --from <account> --key <private key>
+ *                    [--token eonio.token] [--balances-per-trx 100] [--in-flight 16]
+ *
+ *  The balances are sent from `from` with eonio.token::transfern, and up to in-flight transactions
+ *  are outstanding at once.
+ */
+#include "genesis_loader.hpp"
+
+#include <fc/network/http/http_client.hpp>
+#include <fc/network/url.hpp>
+#include <fc/variant_object.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+using namespace eosio_genesis;
+
+namespace {
+
+/**
+ *  Pushes transactions to a node from in_flight connections, each connection waits for the answer to
+ *  its transaction before it takes the next one. push() blocks once in_flight more transactions wait.
+ */
+class trx_pipeline {
+public:
+   trx_pipeline( const std::string& endpoint, size_t in_flight )
+   :_url( endpoint + "/v1/chain/push_transaction" ), _max_queued( in_flight ) {
+      for( size_t i = 0; i < in_flight; ++i )
+         _workers.emplace_back( [this]() { run(); } );
+   }
+   ~trx_pipeline() { finish(); }
+
+   void push( packed_transaction&& trx ) {
+      std::unique_lock<std::mutex> lock( _mutex );
+      _not_full.wait( lock, [&]() { return _queue.size() < _max_queued; } );
+      _queue.push_back( std::move( trx ) );
+      _not_empty.notify_one();
+   }
+
+   /// waits until every pushed transaction is answered
+   void finish() {
+      {
+         std::lock_guard<std::mutex> lock( _mutex );
+         _done = true;
+      }
+      _not_empty.notify_all();
+      for( auto& w : _workers ) {
+         if( w.joinable() )
+            w.join();
+      }
+   }
+
+   uint64_t failed()const { return _failed; }
+
+private:
+   void run() {
+      fc::http_client client;
+      for( ;; ) {
+         packed_transaction trx;
+         {
+            std::unique_lock<std::mutex> lock( _mutex );
+            _not_empty.wait( lock, [&]() { return _done || !_queue.empty(); } );
+            if( _queue.empty() )
+               return;
+            trx = std::move( _queue.front() );
+            _queue.pop_front();
+            _not_full.notify_one();
+         }
+         try {
+            client.post_sync( _url, fc::variant( trx ) );
+         } catch( const fc::exception& e ) {
+            ++_failed;
+            elog( "transaction ${id} failed: ${e}", ("id", trx.id())("e", e.to_detail_string()) );
+         } catch( const std::exception& e ) {
+            ++_failed;
+            elog( "transaction ${id} failed: ${e}", ("id", trx.id())("e", e.what()) );
+         }
+      }
+   }
+
+   const fc::url                  _url;
+   const size_t                   _max_queued;
+   std::vector<std::thread>       _workers;
+   std::deque<packed_transaction> _queue;
+   std::mutex                     _mutex;
+   std::condition_variable        _not_empty;
+   std::condition_variable        _not_full;
+   bool                           _done = false;
+   std::atomic<uint64_t>          _failed{0};
+};
+
+struct options {
+   std::string  path;
+   std::string  endpoint;
+   account_name from;
+   std::string  key;
+   account_name token_account    = N(eonio.token);
+   size_t       balances_per_trx = 100;
+   size_t       in_flight        = 16;
+};
+
+void usage( const char* self ) {
+   std::cerr << "usage: " << self << " <balances.csv> <http endpoint> --from <account> --key <private key>\n"
+             << "       [--token eonio.token] [--balances-per-trx 100] [--in-flight 16]" << std::endl;
+}
+
+bool parse_options( int argc, char** argv, options& opts ) {
+   std::vector<std::string> positional;
+   for( int i = 1; i < argc; ++i ) {
+      const std::string arg = argv[i];
+      if( arg.size() < 2 || arg.compare( 0, 2, "--" ) != 0 ) {
+         positional.push_back( arg );
+         continue;
+      }
+      if( i + 1 == argc )
+         return false;
+      const std::string value = argv[++i];
+      if( arg == "--from" )                  opts.from = account_name( value );
+      else if( arg == "--key" )              opts.key = value;
+      else if( arg == "--token" )            opts.token_account = account_name( value );
+      else if( arg == "--balances-per-trx" ) opts.balances_per_trx = std::stoul( value );
+      else if( arg == "--in-flight" )        opts.in_flight = std::stoul( value );
+      else return false;
+   }
+   if( positional.size() != 2 || !opts.from || opts.key.empty() || opts.balances_per_trx == 0 || opts.in_flight == 0 )
+      return false;
+   opts.path     = positional[0];
+   opts.endpoint = positional[1];
+   while( !opts.endpoint.empty() && opts.endpoint.back() == '/' )
+      opts.endpoint.pop_back();
+   return true;
+}
+
+} /// namespace
+
+int main( int argc, char** argv ) {
+   options opts;
+   try {
+      if( !parse_options( argc, argv, opts ) ) {
+         usage( argv[0] );
+         return 1;
+      }
+   } catch( const std::exception& ) {
+      usage( argv[0] );
+      return 1;
+   }
+
+   try {
+      const private_key_type key( opts.key );
+      const fc::url          info_url( opts.endpoint + "/v1/chain/get_info" );
+      fc::http_client        client;
+
+      auto get_info = [&]() { return client.post_sync( info_url, fc::mutable_variant_object() ).get_object(); };
+      const auto chain_id = get_info()["chain_id"].as<chain_id_type>();
+
+      /// transactions reference a recent head block and are refreshed well before they expire
+      transaction_header header;
+      auto               refreshed = std::chrono::steady_clock::time_point();
+      auto refresh_header = [&]() {
+         const auto info = get_info();
+         header.set_reference_block( info["head_block_id"].as<block_id_type>() );
+         header.expiration = info["head_block_time"].as<fc::time_point_sec>() + fc::seconds( 120 );
+         refreshed = std::chrono::steady_clock::now();
+      };
+      refresh_header();
+
+      mapped_file    file( opts.path );
+      balance_reader reader( file.contents() );
+      trx_pipeline   pipeline( opts.endpoint, opts.in_flight );
+      uint64_t       balances     = 0;
+      uint64_t       transactions = 0;
+      const auto     start = std::chrono::steady_clock::now();
+
+      transfern_args args{ opts.from, {}, {} };
+      args.transfers.reserve( opts.balances_per_trx );
+
+      auto push = [&]() {
+         if( std::chrono::steady_clock::now() - refreshed > std::chrono::seconds( 30 ) )
+            refresh_header();
+         /// the memo keeps transactions with the same balances distinct
+         args.memo = "genesis " + std::to_string( transactions );
+         pipeline.push( packed_transaction( make_transfern_trx( args, opts.token_account, header, key, chain_id ),
+                                            packed_transaction::none ) );
+         balances += args.transfers.size();
+         ++transactions;
+         args.transfers.clear();
+      };
+
+      transfer_entry entry;
+      while( reader.next( entry.to, entry.quantity ) ) {
+         args.transfers.push_back( entry );
+         if( args.transfers.size() == opts.balances_per_trx )
+            push();
+      }
+      if( !args.transfers.empty() )
+         push();
+      pipeline.finish();
+
+      const double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+      std::cout << "loaded " << balances << " balances in " << transactions << " transactions, "
+                << pipeline.failed() << " failed, " << seconds << " s, "
+                << ( seconds > 0 ? balances / seconds : 0 ) << " balances/s" << std::endl;
+      return pipeline.failed() == 0 ? 0 : 1;
+   } catch( const fc::exception& e ) {
+      elog( "${e}", ("e", e.to_detail_string()) );
+   } catch( const std::exception& e ) {
+      elog( "${e}", ("e", e.what()) );
+   }
+   return 1;
+}